@@ -42,6 +42,13 @@ namespace Gears
     void
     warning(const Gears::SubString& description,
       const char* error_code = 0) noexcept;
+
+    /**
+     * Reports the failure as a warning
+     */
+    virtual
+    void
+    on_placement_error(const Gears::SubString& description) noexcept;
   };
 
   typedef std::shared_ptr<ActiveObjectCallback>
@@ -264,17 +271,46 @@ namespace Gears
      * creates ThreadRunner.
      * @param job job to execute in threads
      * @param threads_number number of threads to execute the job in
-     * @param stack_size stack size for threads
+     * @param thread_options options for threads (stack size, placement),
+     * job callback is used as thread callback if it isn't set
      * @param start_threads initial number of threads to start (0 - all)
      */
     explicit
     ActiveObjectCommonImpl(
       const SingleJob_var& job,
       unsigned threads_number = 1,
-      size_t stack_size = 0,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options(),
+      unsigned start_threads = 0)
+      /*throw (InvalidArgument)*/;
+
+    /**
+     * Constructor
+     * @param job job to execute in threads
+     * @param threads_number number of threads to execute the job in
+     * @param stack_size stack size for threads
+     * @param start_threads initial number of threads to start (0 - all)
+     */
+    ActiveObjectCommonImpl(
+      const SingleJob_var& job,
+      unsigned threads_number,
+      size_t stack_size,
       unsigned start_threads = 0)
       /*throw (InvalidArgument)*/;
 
+    /**
+     * Tag of the constructor of an object without own threads
+     */
+    struct ExternalThreads
+    {};
+
+    /**
+     * Constructor of an object without own threads: its job is driven
+     * by external ones (for example, it is a SharedExecutor source)
+     * @param job job to execute in external threads
+     */
+    ActiveObjectCommonImpl(const SingleJob_var& job, ExternalThreads)
+      /*throw (Gears::Exception)*/;
+
     /**
      * Destructor
      */
@@ -290,6 +326,14 @@ namespace Gears
     SingleJob_var SINGLE_JOB_;
     ThreadRunner thread_runner_;
 
+  private:
+    static
+    ThreadRunner::Options
+    thread_options_(
+      const ThreadRunner::Options& thread_options,
+      const SingleJob_var& job)
+      /*throw (Gears::Exception)*/;
+
   private:
     unsigned start_threads_;
 
@@ -335,6 +379,15 @@ namespace Gears
     report_error(WARNING, description, error_code);
   }
 
+  inline
+  void
+  ActiveObjectCallback::on_placement_error(
+    const Gears::SubString& description)
+    noexcept
+  {
+    warning(description);
+  }
+
   //
   // SimpleActiveObject class
   //
@@ -2,14 +2,42 @@
 #define GEARS_COMPOSITE_ACTIVE_OBJECT_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "ActiveObject.hpp"
 #include "OutputMemoryStream.hpp"
 
 namespace Gears
 {
+  namespace CompositeActiveObjectHelper
+  {
+    // pairs of indices: the first operation is finished before
+    // the second one starts
+    typedef std::vector<std::pair<unsigned long, unsigned long> > OrderArray;
+
+    /**
+     * Calls operation for each index of [0, count) in up to threads
+     * temporary threads, an operation starts when all operations
+     * ordered before it are finished. Operation must not throw.
+     * @param count number of operations
+     * @param order ordering of operations, must be acyclic
+     * @param threads maximum number of operations executed at once
+     * @param operation called as operation(index)
+     */
+    void
+    run_ordered(
+      unsigned long count,
+      const OrderArray& order,
+      unsigned long threads,
+      const std::function<void (unsigned long)>& operation)
+      /*throw (Gears::Exception)*/;
+  }
+
   /**
    * class CompositeActiveObjectBase
    * This implements Active Object for control of several Active Objects.
@@ -26,6 +54,14 @@ namespace Gears
    * safe for independent ActiveObjects (other words, use parallel stopping
    * if allow application logic). This behavior tune by the constructor
    * parameter sync_termination.
+   * In parallel mode (parallel_threads constructor parameter) children
+   * are independent unless their order is declared by add_dependency():
+   * activation, deactivation and waiting of independent children are
+   * executed concurrently by temporary threads. A child is activated
+   * after its dependencies are activated and is stopped (deactivated
+   * and waited for) before deactivation of its dependencies.
+   * Durations of children activation and stopping are available
+   * through child_timings().
    * CompositeActiveObject is reference countable object.
    */
   template <typename Container>
@@ -35,17 +71,35 @@ namespace Gears
     DECLARE_EXCEPTION(ChildException, ActiveObject::Exception);
     DECLARE_EXCEPTION(CompositeAlreadyActive, ActiveObject::AlreadyActive);
 
+    /**
+     * Durations of the last state changes of a child
+     */
+    struct ChildTiming
+    {
+      ActiveObject_var child;
+      // duration of the last activate_object() call
+      Time activation;
+      // total duration of deactivate_object() and wait_object() calls
+      // since the last activation
+      Time deactivation;
+    };
+
+    typedef std::vector<ChildTiming> ChildTimingArray;
+
     /**
      * Construct empty not active container for
      * ActiveObjects.
      * @param sync_termination true means do immediately wait after each
-     * child Active Object deactivation.
+     * child Active Object deactivation (ignored in parallel mode).
      * @param clear_on_exit whether to call clear() in destructor or not
+     * @param parallel_threads maximum number of children activated
+     * or stopped at once, 0 - sequential mode
      */
     explicit
     CompositeActiveObjectBase(
       bool sync_termination = false,
-      bool clear_on_exit = true)
+      bool clear_on_exit = true,
+      unsigned long parallel_threads = 0)
       noexcept;
 
     /**
@@ -84,7 +138,41 @@ namespace Gears
     add_child_object(const ActiveObject_var& child, bool add_to_head = false)
       /*throw (Exception, Gears::Exception)*/;
 
+    /**
+     * Declares that the child depends on another child: it is activated
+     * after the dependency and is stopped before the dependency is
+     * deactivated. Dependencies are respected in parallel mode only,
+     * sequential mode keeps the order of the children list.
+     * @param child added child object
+     * @param dependency added child object the child depends on
+     */
+    void
+    add_dependency(
+      const ActiveObject_var& child,
+      const ActiveObject_var& dependency)
+      /*throw (Exception, Gears::Exception)*/;
+
+    /**
+     * @return timings of children in the order of the children list
+     */
+    ChildTimingArray
+    child_timings() /*throw (Gears::Exception)*/;
+
   protected:
+    typedef std::vector<ActiveObject_var> ActiveObjectArray;
+
+    // pairs of child and its dependency
+    typedef std::vector<std::pair<ActiveObject*, ActiveObject*> >
+      DependencyArray;
+
+    struct Timing
+    {
+      Time activation;
+      Time deactivation;
+    };
+
+    typedef std::unordered_map<const ActiveObject*, Timing> TimingMap;
+
     // SimpleActiveObject interface
     /**
      * Activate all owned active objects. For empty case, simply change
@@ -125,17 +213,86 @@ namespace Gears
       /*throw (Exception, Gears::Exception)*/;
 
     /**
-     * Thread-unsafe deactivation logic
+     * Thread-unsafe deactivation logic, in parallel mode deactivates
+     * only children without dependent ones
      */
     void
     deactivate_object_(typename Container::reverse_iterator rit)
       /*throw (Exception, Gears::Exception)*/;
 
+    /**
+     * Activates children in parallel mode, stops activated ones
+     * if any child fails
+     */
+    void
+    activate_parallel_()
+      /*throw (ActiveObject::Exception, Gears::Exception)*/;
+
+    /**
+     * Deactivates and waits for children in parallel mode
+     * @param children children to stop
+     * @param dependencies dependencies between them
+     */
+    void
+    stop_parallel_(
+      const ActiveObjectArray& children,
+      const DependencyArray& dependencies)
+      /*throw (Exception, Gears::Exception)*/;
+
+    /**
+     * Orders children indices by dependencies
+     * @param stop order of stopping (dependent first) instead of
+     * order of activation
+     */
+    static
+    CompositeActiveObjectHelper::OrderArray
+    order_(
+      const ActiveObjectArray& children,
+      const DependencyArray& dependencies,
+      bool stop)
+      /*throw (Gears::Exception)*/;
+
+    /**
+     * @return true if other child depends on the child
+     */
+    bool
+    has_dependents_(const ActiveObject* child) const noexcept;
+
+    /**
+     * @return true if the child depends on the object directly
+     * or through other children
+     */
+    bool
+    depends_(const ActiveObject* child, const ActiveObject* object) const
+      noexcept;
+
+    // state changes of a child with accounting of their durations
+    void
+    activate_child_(const ActiveObject_var& child)
+      /*throw (Exception, Gears::Exception)*/;
+
+    void
+    deactivate_child_(const ActiveObject_var& child)
+      /*throw (Exception, Gears::Exception)*/;
+
+    void
+    wait_child_(const ActiveObject_var& child)
+      /*throw (Exception, Gears::Exception)*/;
+
+    void
+    add_deactivation_time_(const ActiveObject_var& child, const Time& start)
+      noexcept;
+
   protected:
     const bool SYNCHRONOUS_;
     const bool CLEAR_ON_EXIT_;
+    const unsigned long PARALLEL_THREADS_;
 
     Container child_objects_;
+    DependencyArray dependencies_;
+
+    Mutex timings_lock_;
+    TimingMap timings_;
   };
 
   /**
@@ -155,9 +312,13 @@ namespace Gears
 {
   template <typename Container>
   CompositeActiveObjectBase<Container>::CompositeActiveObjectBase(
-    bool sync_termination, bool clear_on_exit) noexcept
+    bool sync_termination,
+    bool clear_on_exit,
+    unsigned long parallel_threads)
+    noexcept
     : SYNCHRONOUS_(sync_termination),
-      CLEAR_ON_EXIT_(clear_on_exit)
+      CLEAR_ON_EXIT_(clear_on_exit),
+      PARALLEL_THREADS_(parallel_threads)
   {}
 
   template <typename Container>
@@ -189,12 +350,18 @@ namespace Gears
   {
     static const char* FUN = "CompositeActiveObjectBase::activate_object_()";
 
+    if (PARALLEL_THREADS_)
+    {
+      activate_parallel_();
+      return;
+    }
+
     typename Container::iterator it(child_objects_.begin());
     try
     {
       for (; it != child_objects_.end(); ++it)
       {
-        (*it)->activate_object();
+        activate_child_(*it);
       }
     }
     catch (const Gears::Exception& e)
@@ -237,6 +404,7 @@ namespace Gears
     /*throw (Exception, Gears::Exception)*/
   {
     std::deque<ActiveObject_var> copy_of_child_objects;
+    DependencyArray copy_of_dependencies;
 
     {
       Condition::Guard guard(cond_);
@@ -245,6 +413,17 @@ namespace Gears
       {
         copy_of_child_objects.push_back(*itor);
       }
+      copy_of_dependencies = dependencies_;
+    }
+
+    if (PARALLEL_THREADS_)
+    {
+      stop_parallel_(
+        ActiveObjectArray(
+          copy_of_child_objects.begin(),
+          copy_of_child_objects.end()),
+        copy_of_dependencies);
+      return;
     }
 
     wait_for_some_objects_(
@@ -303,12 +482,25 @@ namespace Gears
 
     if (state_ != AS_NOT_ACTIVE)
     {
-      typename Container::reverse_iterator rit(child_objects_.rbegin());
-      deactivate_object_(rit);
-      wait_for_some_objects_(rit, child_objects_.rend());
+      if (PARALLEL_THREADS_)
+      {
+        stop_parallel_(
+          ActiveObjectArray(child_objects_.begin(), child_objects_.end()),
+          dependencies_);
+      }
+      else
+      {
+        typename Container::reverse_iterator rit(child_objects_.rbegin());
+        deactivate_object_(rit);
+        wait_for_some_objects_(rit, child_objects_.rend());
+      }
       state_ = AS_NOT_ACTIVE;
     }
     child_objects_.clear();
+    dependencies_.clear();
+
+    Mutex::WriteGuard timings_guard(timings_lock_);
+    timings_.clear();
   }
 
   template <typename Container>
@@ -326,7 +518,7 @@ namespace Gears
     {
       try
       {
-        (*rit)->wait_object();
+        wait_child_(*rit);
       }
       catch (const Gears::Exception& ex)
       {
@@ -358,12 +550,18 @@ namespace Gears
 
     for (; rit != child_objects_.rend(); ++rit)
     {
+      if (PARALLEL_THREADS_ && has_dependents_(rit->get()))
+      {
+        // stopped by wait_object_() after the dependent children
+        continue;
+      }
+
       try
       {
-        (*rit)->deactivate_object();
-        if (SYNCHRONOUS_)
+        deactivate_child_(*rit);
+        if (SYNCHRONOUS_ && !PARALLEL_THREADS_)
         {
-          (*rit)->wait_object();
+          wait_child_(*rit);
         }
       }
       catch (const Gears::Exception& ex)
@@ -394,6 +592,345 @@ namespace Gears
       (*it)->clear();
     }
   }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::add_dependency(
+    const ActiveObject_var& child,
+    const ActiveObject_var& dependency)
+    /*throw (Exception, Gears::Exception)*/
+  {
+    static const char* FUN = "CompositeActiveObjectBase::add_dependency()";
+
+    Condition::Guard guard(cond_);
+
+    if (!child || !dependency || child == dependency ||
+        std::find(child_objects_.begin(), child_objects_.end(), child) ==
+          child_objects_.end() ||
+        std::find(child_objects_.begin(), child_objects_.end(), dependency) ==
+          child_objects_.end())
+    {
+      Gears::ErrorStream ostr;
+      ostr << FUN << ": objects aren't different children";
+      throw Exception(ostr.str());
+    }
+
+    if (depends_(dependency.get(), child.get()))
+    {
+      Gears::ErrorStream ostr;
+      ostr << FUN << ": dependency cycle";
+      throw Exception(ostr.str());
+    }
+
+    dependencies_.emplace_back(child.get(), dependency.get());
+  }
+
+  template <typename Container>
+  typename CompositeActiveObjectBase<Container>::ChildTimingArray
+  CompositeActiveObjectBase<Container>::child_timings()
+    /*throw (Gears::Exception)*/
+  {
+    ChildTimingArray result;
+
+    Condition::Guard guard(cond_);
+    Mutex::WriteGuard timings_guard(timings_lock_);
+
+    result.reserve(child_objects_.size());
+
+    for (typename Container::iterator it(child_objects_.begin());
+      it != child_objects_.end(); ++it)
+    {
+      ChildTiming timing;
+      timing.child = *it;
+
+      auto timing_it = timings_.find(it->get());
+      if (timing_it != timings_.end())
+      {
+        timing.activation = timing_it->second.activation;
+        timing.deactivation = timing_it->second.deactivation;
+      }
+
+      result.push_back(timing);
+    }
+
+    return result;
+  }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::activate_parallel_()
+    /*throw (ActiveObject::Exception, Gears::Exception)*/
+  {
+    static const char* FUN = "CompositeActiveObjectBase::activate_parallel_()";
+
+    const ActiveObjectArray children(
+      child_objects_.begin(), child_objects_.end());
+    // written by different threads, one element each
+    std::vector<char> activated(children.size(), 0);
+    std::atomic<bool> failed(false);
+    Mutex errors_lock;
+    Gears::ErrorStream errors;
+
+    try
+    {
+      CompositeActiveObjectHelper::run_ordered(
+        children.size(),
+        order_(children, dependencies_, false),
+        PARALLEL_THREADS_,
+        [&](unsigned long i)
+        {
+          // activation stops at the first failure
+          if (failed.load(std::memory_order_relaxed))
+          {
+            return;
+          }
+
+          try
+          {
+            activate_child_(children[i]);
+            activated[i] = 1;
+          }
+          catch (const Gears::Exception& ex)
+          {
+            failed.store(true, std::memory_order_relaxed);
+
+            Mutex::WriteGuard guard(errors_lock);
+            errors << ex.what() << std::endl;
+          }
+        });
+    }
+    catch (const Gears::Exception& ex)
+    {
+      failed.store(true, std::memory_order_relaxed);
+      errors << ex.what() << std::endl;
+    }
+
+    if (!failed.load(std::memory_order_relaxed))
+    {
+      return;
+    }
+
+    ActiveObjectArray activated_children;
+
+    for (unsigned long i = 0; i < children.size(); ++i)
+    {
+      if (activated[i])
+      {
+        activated_children.push_back(children[i]);
+      }
+    }
+
+    state_ = AS_DEACTIVATING;
+
+    try
+    {
+      stop_parallel_(activated_children, dependencies_);
+    }
+    catch (const Gears::Exception& ex)
+    {
+      errors << ex.what();
+    }
+
+    state_ = AS_NOT_ACTIVE;
+
+    Gears::ErrorStream ostr;
+    ostr << FUN << ": " << errors.str();
+    throw ChildException(ostr.str());
+  }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::stop_parallel_(
+    const ActiveObjectArray& children,
+    const DependencyArray& dependencies)
+    /*throw (Exception, Gears::Exception)*/
+  {
+    static const char* FUN = "CompositeActiveObjectBase::stop_parallel_()";
+
+    Mutex errors_lock;
+    Gears::ErrorStream all_errors;
+
+    CompositeActiveObjectHelper::run_ordered(
+      children.size(),
+      order_(children, dependencies, true),
+      PARALLEL_THREADS_,
+      [&](unsigned long i)
+      {
+        // dependencies are stopped even if the child fails
+        try
+        {
+          deactivate_child_(children[i]);
+          wait_child_(children[i]);
+        }
+        catch (const Gears::Exception& ex)
+        {
+          Mutex::WriteGuard guard(errors_lock);
+          all_errors << ex.what() << std::endl;
+        }
+      });
+
+    const Gears::SubString& all_errors_str = all_errors.str();
+
+    if (all_errors_str.size())
+    {
+      Gears::ErrorStream ostr;
+      ostr << FUN <<
+        ": Can't stop child active object. Caught Gears::Exception:\n";
+      ostr << all_errors_str;
+      throw Exception(ostr.str());
+    }
+  }
+
+  template <typename Container>
+  CompositeActiveObjectHelper::OrderArray
+  CompositeActiveObjectBase<Container>::order_(
+    const ActiveObjectArray& children,
+    const DependencyArray& dependencies,
+    bool stop)
+    /*throw (Gears::Exception)*/
+  {
+    std::unordered_map<const ActiveObject*, unsigned long> indices;
+
+    for (unsigned long i = 0; i < children.size(); ++i)
+    {
+      indices.emplace(children[i].get(), i);
+    }
+
+    CompositeActiveObjectHelper::OrderArray order;
+
+    for (auto it = dependencies.begin(); it != dependencies.end(); ++it)
+    {
+      auto child_it = indices.find(it->first);
+      auto dependency_it = indices.find(it->second);
+
+      // dependencies of children out of the set are ignored
+      if (child_it != indices.end() && dependency_it != indices.end())
+      {
+        if (stop)
+        {
+          order.emplace_back(child_it->second, dependency_it->second);
+        }
+        else
+        {
+          order.emplace_back(dependency_it->second, child_it->second);
+        }
+      }
+    }
+
+    return order;
+  }
+
+  template <typename Container>
+  bool
+  CompositeActiveObjectBase<Container>::has_dependents_(
+    const ActiveObject* child) const noexcept
+  {
+    for (auto it = dependencies_.begin(); it != dependencies_.end(); ++it)
+    {
+      if (it->second == child)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  template <typename Container>
+  bool
+  CompositeActiveObjectBase<Container>::depends_(
+    const ActiveObject* child,
+    const ActiveObject* object) const
+    noexcept
+  {
+    if (child == object)
+    {
+      return true;
+    }
+
+    for (auto it = dependencies_.begin(); it != dependencies_.end(); ++it)
+    {
+      if (it->first == child && depends_(it->second, object))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::activate_child_(
+    const ActiveObject_var& child)
+    /*throw (Exception, Gears::Exception)*/
+  {
+    const Time start = Time::get_time_of_day();
+
+    child->activate_object();
+
+    const Time duration = Time::get_time_of_day() - start;
+
+    Mutex::WriteGuard guard(timings_lock_);
+    Timing& timing = timings_[child.get()];
+    timing.activation = duration;
+    timing.deactivation = Time::ZERO;
+  }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::deactivate_child_(
+    const ActiveObject_var& child)
+    /*throw (Exception, Gears::Exception)*/
+  {
+    const Time start = Time::get_time_of_day();
+
+    try
+    {
+      child->deactivate_object();
+    }
+    catch (...)
+    {
+      add_deactivation_time_(child, start);
+      throw;
+    }
+
+    add_deactivation_time_(child, start);
+  }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::add_deactivation_time_(
+    const ActiveObject_var& child,
+    const Time& start)
+    noexcept
+  {
+    const Time duration = Time::get_time_of_day() - start;
+
+    Mutex::WriteGuard guard(timings_lock_);
+    timings_[child.get()].deactivation += duration;
+  }
+
+  template <typename Container>
+  void
+  CompositeActiveObjectBase<Container>::wait_child_(
+    const ActiveObject_var& child)
+    /*throw (Exception, Gears::Exception)*/
+  {
+    const Time start = Time::get_time_of_day();
+
+    try
+    {
+      child->wait_object();
+    }
+    catch (...)
+    {
+      add_deactivation_time_(child, start);
+      throw;
+    }
+
+    add_deactivation_time_(child, start);
+  }
 }
 
 #endif
@@ -0,0 +1,515 @@
+#ifndef GEARS_COROUTINE_HPP_
+#define GEARS_COROUTINE_HPP_
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "TaskRunner.hpp"
+#include "Planner.hpp"
+
+namespace Gears
+{
+  /**
+   * Coroutine return type compatible with Task.
+   * Coroutine is created suspended and is started either by execute()
+   * (TaskRunner can run it as any other task, the coroutine frame owns
+   * itself after that) or by co_await from another coroutine (the
+   * awaiting coroutine is resumed when this one finishes and gets its
+   * exception).
+   *
+   *   Gears::CoroutineTask
+   *   handle_request(Gears::TaskRunner* runner, Gears::Planner* planner)
+   *   {
+   *     co_await runner->schedule();
+   *     ...
+   *     co_await planner->sleep_until(Gears::Time::get_time_of_day() + delay);
+   *     co_await runner->schedule();
+   *     ...
+   *   }
+   *
+   *   runner->enqueue_task(
+   *     std::make_shared<Gears::CoroutineTask>(handle_request(runner, planner)));
+   *
+   * Exceptions of a started by execute() coroutine are rethrown to the
+   * code that resumed it last time: TaskRunner or Planner report them
+   * through the callback. A coroutine waiting in TaskRunner or Planner
+   * that is cleared (or destroyed) is never resumed.
+   */
+  class CoroutineTask: public Task
+  {
+  public:
+    DECLARE_EXCEPTION(Exception, Gears::DescriptiveException);
+    DECLARE_EXCEPTION(AlreadyStarted, Exception);
+
+    class promise_type;
+
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    class promise_type
+    {
+    public:
+      promise_type() noexcept;
+
+      CoroutineTask
+      get_return_object() noexcept;
+
+      std::suspend_always
+      initial_suspend() const noexcept;
+
+      auto
+      final_suspend() const noexcept;
+
+      void
+      return_void() const noexcept;
+
+      void
+      unhandled_exception() noexcept;
+
+    private:
+      friend class CoroutineTask;
+
+      struct FinalAwaiter
+      {
+        bool
+        await_ready() const noexcept;
+
+        std::coroutine_handle<>
+        await_suspend(Handle coroutine) const noexcept;
+
+        void
+        await_resume() const noexcept;
+      };
+
+      // coroutine awaiting this one
+      std::coroutine_handle<> continuation_;
+      std::exception_ptr exception_;
+      // started by execute(), frame is destroyed on completion
+      bool detached_;
+    };
+
+    /**
+     * Awaiter of co_await on CoroutineTask
+     */
+    class Awaiter
+    {
+    public:
+      explicit
+      Awaiter(Handle coroutine) noexcept;
+
+      bool
+      await_ready() const noexcept;
+
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> awaiting) const noexcept;
+
+      void
+      await_resume() const /*throw(Gears::Exception)*/;
+
+    private:
+      Handle coroutine_;
+    };
+
+    CoroutineTask(CoroutineTask&& other) noexcept;
+
+    CoroutineTask(const CoroutineTask&) = delete;
+
+    virtual
+    ~CoroutineTask() noexcept;
+
+    CoroutineTask&
+    operator=(CoroutineTask&& other) noexcept;
+
+    CoroutineTask&
+    operator=(const CoroutineTask&) = delete;
+
+    /**
+     * Starts the coroutine, it runs until the first suspension.
+     * Can be called once.
+     */
+    virtual void
+    execute() /*throw(AlreadyStarted, Gears::Exception)*/;
+
+    /**
+     * Starts the coroutine and suspends the awaiting one until
+     * its completion
+     */
+    Awaiter
+    operator co_await() && noexcept;
+
+    /**
+     * Resumes a coroutine, rethrows an exception of CoroutineTask
+     * started by execute() if it is finished with it.
+     * Used by awaiters of TaskRunner and Planner.
+     * @param coroutine suspended coroutine
+     */
+    static
+    void
+    resume(std::coroutine_handle<> coroutine) /*throw(Gears::Exception)*/;
+
+  private:
+    explicit
+    CoroutineTask(Handle coroutine) noexcept;
+
+  private:
+    // exception of detached coroutine finished in this thread
+    static thread_local std::exception_ptr finished_exception_;
+
+    Handle coroutine_;
+  };
+
+  /**
+   * Awaiter of TaskRunner::schedule(): resumes the coroutine in
+   * a working thread of the runner
+   */
+  class TaskRunner::ScheduleAwaiter
+  {
+  public:
+    explicit
+    ScheduleAwaiter(TaskRunner* task_runner) noexcept;
+
+    bool
+    await_ready() const noexcept;
+
+    void
+    await_suspend(std::coroutine_handle<> coroutine) const
+      /*throw(Overflow, NotActive, Gears::Exception)*/;
+
+    void
+    await_resume() const noexcept;
+
+  private:
+    TaskRunner* task_runner_;
+  };
+
+  /**
+   * Awaiter of Planner::sleep_until(): resumes the coroutine in
+   * the planner thread at the time. Planner thread should not do
+   * long work, resume on TaskRunner after it.
+   */
+  class Planner::SleepAwaiter
+  {
+  public:
+    SleepAwaiter(Planner* planner, const Time& time) noexcept;
+
+    bool
+    await_ready() const noexcept;
+
+    void
+    await_suspend(std::coroutine_handle<> coroutine) const
+      /*throw(Exception, Gears::Exception)*/;
+
+    void
+    await_resume() const noexcept;
+
+  private:
+    class ResumeGoal: public Goal
+    {
+    public:
+      explicit
+      ResumeGoal(std::coroutine_handle<> coroutine) noexcept;
+
+      virtual void
+      deliver() /*throw(Gears::Exception)*/;
+
+    private:
+      std::coroutine_handle<> coroutine_;
+    };
+
+    Planner* planner_;
+    Time time_;
+  };
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  //
+  // CoroutineTask::promise_type class
+  //
+
+  inline
+  CoroutineTask::promise_type::promise_type() noexcept
+    : detached_(false)
+  {}
+
+  inline
+  CoroutineTask
+  CoroutineTask::promise_type::get_return_object() noexcept
+  {
+    return CoroutineTask(Handle::from_promise(*this));
+  }
+
+  inline
+  std::suspend_always
+  CoroutineTask::promise_type::initial_suspend() const noexcept
+  {
+    return std::suspend_always();
+  }
+
+  inline
+  auto
+  CoroutineTask::promise_type::final_suspend() const noexcept
+  {
+    return FinalAwaiter();
+  }
+
+  inline
+  void
+  CoroutineTask::promise_type::return_void() const noexcept
+  {}
+
+  inline
+  void
+  CoroutineTask::promise_type::unhandled_exception() noexcept
+  {
+    exception_ = std::current_exception();
+  }
+
+  inline
+  bool
+  CoroutineTask::promise_type::FinalAwaiter::await_ready() const noexcept
+  {
+    return false;
+  }
+
+  inline
+  std::coroutine_handle<>
+  CoroutineTask::promise_type::FinalAwaiter::await_suspend(
+    Handle coroutine) const noexcept
+  {
+    promise_type& promise = coroutine.promise();
+
+    if (promise.continuation_)
+    {
+      return promise.continuation_;
+    }
+
+    if (promise.detached_)
+    {
+      // resume() that resumed this coroutine rethrows the exception
+      finished_exception_ = std::move(promise.exception_);
+      coroutine.destroy();
+    }
+
+    return std::noop_coroutine();
+  }
+
+  inline
+  void
+  CoroutineTask::promise_type::FinalAwaiter::await_resume() const noexcept
+  {}
+
+  //
+  // CoroutineTask::Awaiter class
+  //
+
+  inline
+  CoroutineTask::Awaiter::Awaiter(Handle coroutine) noexcept
+    : coroutine_(coroutine)
+  {}
+
+  inline
+  bool
+  CoroutineTask::Awaiter::await_ready() const noexcept
+  {
+    return !coroutine_;
+  }
+
+  inline
+  std::coroutine_handle<>
+  CoroutineTask::Awaiter::await_suspend(
+    std::coroutine_handle<> awaiting) const noexcept
+  {
+    coroutine_.promise().continuation_ = awaiting;
+    return coroutine_;
+  }
+
+  inline
+  void
+  CoroutineTask::Awaiter::await_resume() const /*throw(Gears::Exception)*/
+  {
+    if (coroutine_ && coroutine_.promise().exception_)
+    {
+      std::rethrow_exception(coroutine_.promise().exception_);
+    }
+  }
+
+  //
+  // CoroutineTask class
+  //
+
+  inline
+  CoroutineTask::CoroutineTask(Handle coroutine) noexcept
+    : coroutine_(coroutine)
+  {}
+
+  inline
+  CoroutineTask::CoroutineTask(CoroutineTask&& other) noexcept
+    : coroutine_(std::exchange(other.coroutine_, Handle()))
+  {}
+
+  inline
+  CoroutineTask::~CoroutineTask() noexcept
+  {
+    if (coroutine_)
+    {
+      coroutine_.destroy();
+    }
+  }
+
+  inline
+  CoroutineTask&
+  CoroutineTask::operator=(CoroutineTask&& other) noexcept
+  {
+    if (this != &other)
+    {
+      if (coroutine_)
+      {
+        coroutine_.destroy();
+      }
+
+      coroutine_ = std::exchange(other.coroutine_, Handle());
+    }
+
+    return *this;
+  }
+
+  inline
+  void
+  CoroutineTask::execute() /*throw(AlreadyStarted, Gears::Exception)*/
+  {
+    static const char* FUN = "CoroutineTask::execute()";
+
+    if (!coroutine_)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": coroutine is already started";
+      throw AlreadyStarted(ostr.str());
+    }
+
+    Handle coroutine = std::exchange(coroutine_, Handle());
+    coroutine.promise().detached_ = true;
+    resume(coroutine);
+  }
+
+  inline
+  CoroutineTask::Awaiter
+  CoroutineTask::operator co_await() && noexcept
+  {
+    return Awaiter(coroutine_);
+  }
+
+  inline
+  void
+  CoroutineTask::resume(std::coroutine_handle<> coroutine)
+    /*throw(Gears::Exception)*/
+  {
+    coroutine.resume();
+
+    if (finished_exception_)
+    {
+      std::rethrow_exception(std::exchange(finished_exception_, nullptr));
+    }
+  }
+
+  inline thread_local std::exception_ptr
+    CoroutineTask::finished_exception_;
+
+  //
+  // TaskRunner::ScheduleAwaiter class
+  //
+
+  inline
+  TaskRunner::ScheduleAwaiter::ScheduleAwaiter(TaskRunner* task_runner)
+    noexcept
+    : task_runner_(task_runner)
+  {}
+
+  inline
+  bool
+  TaskRunner::ScheduleAwaiter::await_ready() const noexcept
+  {
+    return false;
+  }
+
+  inline
+  void
+  TaskRunner::ScheduleAwaiter::await_suspend(
+    std::coroutine_handle<> coroutine) const
+    /*throw(Overflow, NotActive, Gears::Exception)*/
+  {
+    // handle fits into InlineTask: no allocation per resumption
+    task_runner_->enqueue_task(
+      InlineTask([coroutine]() { CoroutineTask::resume(coroutine); }));
+  }
+
+  inline
+  void
+  TaskRunner::ScheduleAwaiter::await_resume() const noexcept
+  {}
+
+  inline
+  TaskRunner::ScheduleAwaiter
+  TaskRunner::schedule() noexcept
+  {
+    return ScheduleAwaiter(this);
+  }
+
+  //
+  // Planner::SleepAwaiter class
+  //
+
+  inline
+  Planner::SleepAwaiter::ResumeGoal::ResumeGoal(
+    std::coroutine_handle<> coroutine) noexcept
+    : coroutine_(coroutine)
+  {}
+
+  inline
+  void
+  Planner::SleepAwaiter::ResumeGoal::deliver() /*throw(Gears::Exception)*/
+  {
+    CoroutineTask::resume(coroutine_);
+  }
+
+  inline
+  Planner::SleepAwaiter::SleepAwaiter(Planner* planner, const Time& time)
+    noexcept
+    : planner_(planner),
+      time_(time)
+  {}
+
+  inline
+  bool
+  Planner::SleepAwaiter::await_ready() const noexcept
+  {
+    return false;
+  }
+
+  inline
+  void
+  Planner::SleepAwaiter::await_suspend(
+    std::coroutine_handle<> coroutine) const
+    /*throw(Exception, Gears::Exception)*/
+  {
+    planner_->schedule(std::make_shared<ResumeGoal>(coroutine), time_);
+  }
+
+  inline
+  void
+  Planner::SleepAwaiter::await_resume() const noexcept
+  {}
+
+  inline
+  Planner::SleepAwaiter
+  Planner::sleep_until(const Time& time) noexcept
+  {
+    return SleepAwaiter(this, time);
+  }
+}
+
+#endif /*GEARS_COROUTINE_HPP_*/
@@ -0,0 +1,163 @@
+#ifndef GEARS_HISTOGRAM_HPP_
+#define GEARS_HISTOGRAM_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+#include "Time.hpp"
+
+namespace Gears
+{
+  /**
+   * Histogram of durations with power of two buckets:
+   * bucket 0 counts durations less than 1 microsecond, bucket i
+   * counts durations in [2^(i-1), 2^i) microseconds, the last bucket
+   * also counts all longer durations.
+   */
+  struct DurationHistogram
+  {
+    static const unsigned long BUCKETS = 32;
+
+    DurationHistogram() noexcept;
+
+    /**
+     * @param bucket bucket index
+     * @return exclusive upper bound of durations counted by the bucket
+     */
+    static
+    Time
+    bucket_upper_bound(unsigned long bucket) noexcept;
+
+    /**
+     * Approximate percentile
+     * @param fraction part of durations in [0, 1]
+     * @return upper bound of the bucket containing the percentile
+     */
+    Time
+    percentile(double fraction) const noexcept;
+
+    unsigned long count;
+    Time total;
+    Time max;
+    unsigned long buckets[BUCKETS];
+  };
+
+  /**
+   * Histogram buckets filled by one thread and read by any thread.
+   * Only the owner thread writes them, so recording is a couple of
+   * relaxed stores without read-modify-write operations.
+   */
+  class DurationRecorder
+  {
+  public:
+    DurationRecorder() noexcept;
+
+    /**
+     * Accounts durations
+     * @param duration negative durations are counted as zero
+     * @param count number of equal durations
+     */
+    void
+    add(const Time& duration, unsigned long count = 1) noexcept;
+
+    /**
+     * Adds the recorded durations to the histogram
+     */
+    void
+    collect(DurationHistogram& histogram) const noexcept;
+
+  private:
+    template <typename ValueType>
+    static
+    void
+    increment_(std::atomic<ValueType>& value, ValueType add) noexcept;
+
+    static
+    Time
+    usec_to_time_(long long usec) noexcept;
+
+  private:
+    std::atomic<unsigned long> count_;
+    std::atomic<long long> total_;
+    std::atomic<long long> max_;
+    std::atomic<unsigned long> buckets_[DurationHistogram::BUCKETS];
+  };
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  //
+  // DurationRecorder class
+  //
+
+  inline
+  DurationRecorder::DurationRecorder() noexcept
+    : count_(0),
+      total_(0),
+      max_(0)
+  {
+    for(unsigned long i = 0; i < DurationHistogram::BUCKETS; ++i)
+    {
+      buckets_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  inline
+  void
+  DurationRecorder::add(const Time& duration, unsigned long count) noexcept
+  {
+    const long long usec = std::max(duration.microseconds(), 0ll);
+    const unsigned long bucket = std::min<unsigned long>(
+      std::bit_width(static_cast<unsigned long long>(usec)),
+      DurationHistogram::BUCKETS - 1);
+
+    increment_(buckets_[bucket], count);
+    increment_(count_, count);
+    increment_(total_, usec * static_cast<long long>(count));
+
+    if(usec > max_.load(std::memory_order_relaxed))
+    {
+      max_.store(usec, std::memory_order_relaxed);
+    }
+  }
+
+  inline
+  void
+  DurationRecorder::collect(DurationHistogram& histogram) const noexcept
+  {
+    histogram.count += count_.load(std::memory_order_relaxed);
+    histogram.total += usec_to_time_(total_.load(std::memory_order_relaxed));
+    histogram.max = std::max(
+      histogram.max,
+      usec_to_time_(max_.load(std::memory_order_relaxed)));
+
+    for(unsigned long i = 0; i < DurationHistogram::BUCKETS; ++i)
+    {
+      histogram.buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  template <typename ValueType>
+  void
+  DurationRecorder::increment_(std::atomic<ValueType>& value, ValueType add)
+    noexcept
+  {
+    value.store(
+      value.load(std::memory_order_relaxed) + add,
+      std::memory_order_relaxed);
+  }
+
+  inline
+  Time
+  DurationRecorder::usec_to_time_(long long usec) noexcept
+  {
+    return Time(usec / Time::USEC_MAX, usec % Time::USEC_MAX);
+  }
+}
+
+#endif /*GEARS_HISTOGRAM_HPP_*/
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <boost/asio/io_context.hpp>
 #include <gears/ActiveObject.hpp>
+#include <gears/ThreadRunner.hpp>
+#include <gears/TaskRunner.hpp>
 
 namespace Gears
 {
@@ -30,4 +34,133 @@ namespace Gears
     const int threads_count_;
     std::unique_ptr<Impl> impl_;
   };
+
+  /**
+   * Pool of io_contexts, each one is run by its own thread.
+   * Handlers of a context are executed by a single thread, so contexts
+   * don't contend on the asio scheduler lock as many threads running
+   * one io_context do. Threads are placed by thread options: set
+   * pin_round_robin to pin the thread of context i to the i-th CPU
+   * (of cpu_affinity, NUMA node or process affinity).
+   * Work is distributed by choosing a context: round robin for
+   * independent work, by key for work that must stay on one thread
+   * (connection, session).
+   */
+  class IOContextPool: public SimpleActiveObject
+  {
+  public:
+    /**
+     * Posts Gears::Task objects to a context of the pool.
+     * Exception of a task is reported to the pool callback, it doesn't
+     * stop the context thread.
+     */
+    class Executor
+    {
+    public:
+      Executor(
+        boost::asio::io_context& io_context,
+        const ActiveObjectCallback_var& callback)
+        noexcept;
+
+      boost::asio::io_context&
+      io_context() const noexcept;
+
+      /**
+       * Posts the task, it is executed by the context thread.
+       * Tasks posted to a context are executed in the order of posting.
+       * @param task not null task
+       */
+      void
+      post(Task_var task) const
+        /*throw(InvalidArgument, Gears::Exception)*/;
+
+    private:
+      boost::asio::io_context* io_context_;
+      ActiveObjectCallback_var callback_;
+    };
+
+    /**
+     * Constructor
+     * @param callback not null callback is called on errors
+     * @param contexts_number number of contexts and threads,
+     * 0 - number of cores
+     * @param thread_options options of threads: stack size, placement,
+     * name
+     */
+    explicit
+    IOContextPool(
+      ActiveObjectCallback_var callback,
+      unsigned int contexts_number = 0,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options())
+      /*throw(InvalidArgument, Gears::Exception)*/;
+
+    /**
+     * Destructor, deactivates the pool and waits for its threads
+     */
+    virtual
+    ~IOContextPool() noexcept;
+
+    /**
+     * @return number of contexts
+     */
+    unsigned long
+    size() const noexcept;
+
+    /**
+     * @param index index of context less than size()
+     */
+    boost::asio::io_context&
+    io_context(unsigned long index) noexcept;
+
+    /**
+     * @return context chosen round robin
+     */
+    boost::asio::io_context&
+    next_io_context() noexcept;
+
+    /**
+     * @param key key of the work, equal keys get the same context,
+     * a hash should be used for keys that aren't distributed uniformly
+     * @return context of the key
+     */
+    boost::asio::io_context&
+    key_io_context(unsigned long key) noexcept;
+
+    Executor
+    executor(unsigned long index) noexcept;
+
+    Executor
+    next_executor() noexcept;
+
+    Executor
+    key_executor(unsigned long key) noexcept;
+
+    /**
+     * Allows threads to finish when their contexts run out of work
+     */
+    void
+    clear() /*throw(Gears::Exception)*/;
+
+  protected:
+    void
+    activate_object_() override;
+
+    void
+    deactivate_object_() override;
+
+    void
+    wait_object_() override;
+
+  private:
+    struct Impl;
+
+    static
+    unsigned int
+    contexts_(unsigned int contexts_number) noexcept;
+
+  private:
+    const ActiveObjectCallback_var callback_;
+    std::unique_ptr<Impl> impl_;
+    std::atomic<unsigned long> next_context_;
+  };
 }
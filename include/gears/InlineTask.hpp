@@ -0,0 +1,258 @@
+#ifndef GEARS_INLINETASK_HPP_
+#define GEARS_INLINETASK_HPP_
+
+#include <cstddef>
+#include <concepts>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Gears
+{
+  /**
+   * Move only type erased callable without arguments.
+   * Functors that fit into BUFFER_SIZE bytes and have noexcept move
+   * constructor are kept inside the object: creating, moving and calling
+   * such task doesn't allocate memory and doesn't touch reference counters.
+   * Bigger functors are allocated in the heap.
+   */
+  class InlineTask
+  {
+  public:
+    static const std::size_t BUFFER_SIZE = 7 * sizeof(void*);
+
+    /**
+     * Constructs empty task
+     */
+    InlineTask() noexcept;
+
+    /**
+     * Constructor
+     * @param functor callable to hold
+     */
+    template <typename Functor>
+      requires (!std::same_as<std::decay_t<Functor>, InlineTask> &&
+        std::invocable<std::decay_t<Functor>&>)
+    InlineTask(Functor&& functor) /*throw(Gears::Exception)*/;
+
+    InlineTask(InlineTask&& other) noexcept;
+
+    InlineTask(const InlineTask&) = delete;
+
+    ~InlineTask() noexcept;
+
+    InlineTask&
+    operator=(InlineTask&& other) noexcept;
+
+    InlineTask&
+    operator=(const InlineTask&) = delete;
+
+    /**
+     * @return true if task holds a callable
+     */
+    explicit
+    operator bool() const noexcept;
+
+    /**
+     * Calls held callable, task must not be empty
+     */
+    void
+    operator()() /*throw(Gears::Exception)*/;
+
+    /**
+     * Destroys held callable
+     */
+    void
+    reset() noexcept;
+
+  private:
+    struct Operations
+    {
+      void (*call)(void* storage);
+      // move constructs callable in to and destroys it in from
+      void (*move)(void* from, void* to) noexcept;
+      void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename Functor>
+    struct InlineOperations
+    {
+      static
+      void
+      call(void* storage)
+      {
+        (*static_cast<Functor*>(storage))();
+      }
+
+      static
+      void
+      move(void* from, void* to) noexcept
+      {
+        Functor* functor = static_cast<Functor*>(from);
+        new (to) Functor(std::move(*functor));
+        functor->~Functor();
+      }
+
+      static
+      void
+      destroy(void* storage) noexcept
+      {
+        static_cast<Functor*>(storage)->~Functor();
+      }
+
+      static const Operations OPERATIONS;
+    };
+
+    template <typename Functor>
+    struct HeapOperations
+    {
+      static
+      void
+      call(void* storage)
+      {
+        (**static_cast<Functor**>(storage))();
+      }
+
+      static
+      void
+      move(void* from, void* to) noexcept
+      {
+        *static_cast<Functor**>(to) = *static_cast<Functor**>(from);
+      }
+
+      static
+      void
+      destroy(void* storage) noexcept
+      {
+        delete *static_cast<Functor**>(storage);
+      }
+
+      static const Operations OPERATIONS;
+    };
+
+    template <typename Functor>
+    static constexpr bool
+    is_inline_() noexcept
+    {
+      return sizeof(Functor) <= BUFFER_SIZE &&
+        alignof(Functor) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<Functor>::value;
+    }
+
+  private:
+    alignas(std::max_align_t) unsigned char buffer_[BUFFER_SIZE];
+    const Operations* operations_;
+  };
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  template <typename Functor>
+  const InlineTask::Operations
+  InlineTask::InlineOperations<Functor>::OPERATIONS =
+  {
+    &InlineTask::InlineOperations<Functor>::call,
+    &InlineTask::InlineOperations<Functor>::move,
+    &InlineTask::InlineOperations<Functor>::destroy
+  };
+
+  template <typename Functor>
+  const InlineTask::Operations
+  InlineTask::HeapOperations<Functor>::OPERATIONS =
+  {
+    &InlineTask::HeapOperations<Functor>::call,
+    &InlineTask::HeapOperations<Functor>::move,
+    &InlineTask::HeapOperations<Functor>::destroy
+  };
+
+  inline
+  InlineTask::InlineTask() noexcept
+    : operations_(0)
+  {}
+
+  template <typename Functor>
+    requires (!std::same_as<std::decay_t<Functor>, InlineTask> &&
+      std::invocable<std::decay_t<Functor>&>)
+  InlineTask::InlineTask(Functor&& functor) /*throw(Gears::Exception)*/
+  {
+    typedef std::decay_t<Functor> FunctorType;
+
+    if constexpr (is_inline_<FunctorType>())
+    {
+      new (buffer_) FunctorType(std::forward<Functor>(functor));
+      operations_ = &InlineOperations<FunctorType>::OPERATIONS;
+    }
+    else
+    {
+      *reinterpret_cast<FunctorType**>(buffer_) =
+        new FunctorType(std::forward<Functor>(functor));
+      operations_ = &HeapOperations<FunctorType>::OPERATIONS;
+    }
+  }
+
+  inline
+  InlineTask::InlineTask(InlineTask&& other) noexcept
+    : operations_(other.operations_)
+  {
+    if (operations_)
+    {
+      operations_->move(other.buffer_, buffer_);
+      other.operations_ = 0;
+    }
+  }
+
+  inline
+  InlineTask::~InlineTask() noexcept
+  {
+    reset();
+  }
+
+  inline
+  InlineTask&
+  InlineTask::operator=(InlineTask&& other) noexcept
+  {
+    if (this != &other)
+    {
+      reset();
+
+      if (other.operations_)
+      {
+        other.operations_->move(other.buffer_, buffer_);
+        operations_ = other.operations_;
+        other.operations_ = 0;
+      }
+    }
+
+    return *this;
+  }
+
+  inline
+  InlineTask::operator bool() const noexcept
+  {
+    return operations_ != 0;
+  }
+
+  inline
+  void
+  InlineTask::operator()() /*throw(Gears::Exception)*/
+  {
+    operations_->call(buffer_);
+  }
+
+  inline
+  void
+  InlineTask::reset() noexcept
+  {
+    if (operations_)
+    {
+      operations_->destroy(buffer_);
+      operations_ = 0;
+    }
+  }
+}
+
+#endif /*GEARS_INLINETASK_HPP_*/
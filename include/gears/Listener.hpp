@@ -2,11 +2,15 @@
 #define GEARS_LISTENER_HPP_
 
 #include <event.h>
+#include <list>
 #include <memory>
+#include <span>
+#include <vector>
 
 #include "ActiveObject.hpp"
 //#include <Gears/ArrayAutoPtr.hpp>
 #include "Descriptors.hpp"
+#include "Planner.hpp"
 #include "Time.hpp"
 
 namespace Gears
@@ -55,6 +59,23 @@ namespace Gears
     on_data_ready(int fd, size_t fd_index, const char* str, size_t size)
       noexcept = 0;
 
+    /**
+     * Complete lines found in one read, called once per read in full
+     * lines mode. Lines include the trailing '\n' and point into
+     * the read buffer, they are valid during the call only.
+     * Parts of overlong lines and the rest of data of a closed
+     * descriptor are passed to on_data_ready().
+     * By default calls on_data_ready() for each line.
+     * @param fd file descriptor which was the cause of the event.
+     * @param fd_index index fd in original array of descriptors, used for
+     * listener construction.
+     * @param lines not empty array of lines.
+     */
+    virtual
+    void
+    on_lines_ready(int fd, size_t fd_index, std::span<const SubString> lines)
+      noexcept;
+
     /**
      * Called when a read on a descriptor does not provide data.
      * By default does nothing.
@@ -184,6 +205,15 @@ namespace Gears
     void
     terminate() noexcept;
 
+    /**
+     * Delivers goals of the planner in the listening thread: its timer
+     * is watched together with the descriptors. Call before listen().
+     * @param planner not active CT_MONOTONIC planner
+     */
+    void
+    add_planner(Planner_var planner)
+      /*throw (InvalidArgument, EventFailure, Gears::Exception)*/;
+
   protected:
     DescriptorListenerCallback_var callback_;
 
@@ -250,7 +280,27 @@ namespace Gears
     void
     periodic_callback_(int fd, short type, void* arg) noexcept;
 
+    /**
+     * Context object for each added planner
+     */
+    struct PlannerContext
+    {
+      Planner_var planner;
+      event timer_event;
+    };
+
+    /**
+     * Calls when planner timer expires.
+     * @param fd file descriptor
+     * @param type type of fd
+     * @param arg supplementary info share when event registered.
+     */
+    static
+    void
+    timer_callback_(int fd, short type, void* arg) noexcept;
+
     typedef std::vector<DescriptorActionContext> ReadContexts;
+    typedef std::list<PlannerContext> PlannerContexts;
 
     static const Time PERIOD;
 
@@ -258,7 +308,11 @@ namespace Gears
     const size_t BUFFERS_LENGTH_;
     const bool FULL_LINES_ONLY_;
     ReadContexts read_contexts_;
+    PlannerContexts planner_contexts_;
     size_t closed_descriptors_;
+    // line ends and lines found in the last read, reused between reads
+    std::vector<const char*> line_ends_;
+    std::vector<SubString> lines_;
     event_base* base_;
     NonBlockingReadPipe termination_pipe_;
     event termination_;
@@ -325,6 +379,14 @@ namespace Gears
     virtual
     ~ActiveDescriptorListener() noexcept;
 
+    /**
+     * Delivers goals of the planner in the listener thread.
+     * Call before activation.
+     * @param planner not active CT_MONOTONIC planner
+     */
+    void
+    add_planner(Planner_var planner) /*throw (Gears::Exception)*/;
+
   private:
     class ListenerJob :
       public SingleJob,
@@ -353,6 +415,8 @@ namespace Gears
       virtual void
       terminate() noexcept;
 
+      using DescriptorListener::add_planner;
+
     private:
       /**
        * Implement delegation calls from DLCallback
@@ -394,6 +458,17 @@ namespace Gears
         on_data_ready(int fd, size_t fd_index, const char* str, size_t size)
           noexcept;
 
+        /**
+         * @param fd file descriptor which was the cause of event.
+         * @param fd_index index fd in original array of descriptors, used for
+         * listener construction.
+         * @param lines not empty array of complete lines.
+         */
+        virtual
+        void
+        on_lines_ready(int fd, size_t fd_index,
+          std::span<const SubString> lines) noexcept;
+
         /**
          * @param listener pointer to object which called callback method.
          * @param fd descriptor that has been closed or read fails.
@@ -519,6 +594,17 @@ namespace Gears
     return &*listener_;
   }
 
+  template <typename Listener, typename ListenerHolder>
+  void
+  DescriptorListenerCallbackTempl<Listener, ListenerHolder>::on_lines_ready(
+    int fd, size_t fd_index, std::span<const SubString> lines) noexcept
+  {
+    for (auto it = lines.begin(); it != lines.end(); ++it)
+    {
+      on_data_ready(fd, fd_index, it->data(), it->size());
+    }
+  }
+
   template <typename Listener, typename ListenerHolder>
   void
   DescriptorListenerCallbackTempl<Listener, ListenerHolder>::on_closed(
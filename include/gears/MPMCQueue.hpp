@@ -0,0 +1,223 @@
+#ifndef GEARS_MPMCQUEUE_HPP_
+#define GEARS_MPMCQUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <sched.h>
+
+#include "Uncopyable.hpp"
+
+namespace Gears
+{
+  /**
+   * Bounded lock-free multi-producer multi-consumer queue.
+   * Ring of cells with per-cell sequence numbers: producers and
+   * consumers reserve positions with a single CAS on their own cursor and
+   * never touch a common lock. Capacity is rounded up to a power of two.
+   */
+  template <typename ValueType>
+  class MPMCQueue: private Uncopyable
+  {
+  public:
+    /**
+     * Constructor
+     * @param capacity minimal number of elements the queue can hold
+     */
+    explicit
+    MPMCQueue(size_t capacity) /*throw (Gears::Exception)*/;
+
+    ~MPMCQueue() noexcept;
+
+    /**
+     * Puts value into the queue tail
+     * @param value value to move into the queue
+     * @return false if the queue is full (value is untouched)
+     */
+    bool
+    push(ValueType& value) noexcept;
+
+    /**
+     * Takes value from the queue head.
+     * If a producer reserved the head cell but has not published it yet
+     * the call spins until the value appears.
+     * @param value receiver of the value
+     * @return false if the queue is empty
+     */
+    bool
+    pop(ValueType& value) noexcept;
+
+    /**
+     * Number of elements in the queue.
+     * The result is approximate under concurrent modifications.
+     * @return number of elements
+     */
+    size_t
+    size() const noexcept;
+
+    /**
+     * @return maximum number of elements
+     */
+    size_t
+    capacity() const noexcept;
+
+  private:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    struct Cell
+    {
+      std::atomic<size_t> sequence;
+      ValueType value;
+    };
+
+    static
+    size_t
+    round_capacity_(size_t capacity) noexcept;
+
+  private:
+    const size_t MASK_;
+    std::unique_ptr<Cell[]> cells_;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_;
+  };
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  template <typename ValueType>
+  size_t
+  MPMCQueue<ValueType>::round_capacity_(size_t capacity) noexcept
+  {
+    size_t res = 2;
+    while (res < capacity)
+    {
+      res <<= 1;
+    }
+    return res;
+  }
+
+  template <typename ValueType>
+  MPMCQueue<ValueType>::MPMCQueue(size_t capacity)
+    /*throw (Gears::Exception)*/
+    : MASK_(round_capacity_(capacity) - 1),
+      cells_(new Cell[MASK_ + 1]),
+      enqueue_pos_(0),
+      dequeue_pos_(0)
+  {
+    for (size_t i = 0; i <= MASK_; ++i)
+    {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  template <typename ValueType>
+  MPMCQueue<ValueType>::~MPMCQueue() noexcept
+  {}
+
+  template <typename ValueType>
+  bool
+  MPMCQueue<ValueType>::push(ValueType& value) noexcept
+  {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      cell = &cells_[pos & MASK_];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t diff =
+        static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+      if (diff == 0)
+      {
+        if (enqueue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        // cell still holds the value of the previous round
+        return false;
+      }
+      else
+      {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <typename ValueType>
+  bool
+  MPMCQueue<ValueType>::pop(ValueType& value) noexcept
+  {
+    Cell* cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      cell = &cells_[pos & MASK_];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t diff =
+        static_cast<std::ptrdiff_t>(seq) -
+        static_cast<std::ptrdiff_t>(pos + 1);
+
+      if (diff == 0)
+      {
+        if (dequeue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        if (enqueue_pos_.load(std::memory_order_acquire) == pos)
+        {
+          return false;
+        }
+
+        // cell is reserved by a producer that has not published it yet
+        sched_yield();
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+      else
+      {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    value = std::move(cell->value);
+    cell->value = ValueType();
+    cell->sequence.store(pos + MASK_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  template <typename ValueType>
+  size_t
+  MPMCQueue<ValueType>::size() const noexcept
+  {
+    const size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+    const size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  template <typename ValueType>
+  size_t
+  MPMCQueue<ValueType>::capacity() const noexcept
+  {
+    return MASK_ + 1;
+  }
+}
+
+#endif /*GEARS_MPMCQUEUE_HPP_*/
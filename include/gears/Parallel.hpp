@@ -0,0 +1,384 @@
+#ifndef GEARS_PARALLEL_HPP_
+#define GEARS_PARALLEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <exception>
+#include <memory>
+#include <vector>
+
+#include "Condition.hpp"
+#include "InlineTask.hpp"
+#include "TaskRunner.hpp"
+
+namespace Gears
+{
+  /**
+   * Splits [begin, end) into chunks of grain elements and calls
+   * functor for each chunk in the runner threads and in the calling
+   * thread, returns when all chunks are processed.
+   * The calling thread processes chunks too, so the call makes progress
+   * even if the runner is busy, overflowed, not active or fails
+   * to enqueue; it can be called from tasks of the same runner.
+   * If a chunk throws, not started chunks are skipped and the first
+   * exception is rethrown.
+   * @param task_runner runner to use
+   * @param begin begin of range: integer or random access iterator
+   * @param end end of range
+   * @param grain number of elements in a chunk, 0 - choose by number of
+   * runner threads
+   * @param functor called as functor(chunk_begin, chunk_end) if it
+   * accepts two arguments, otherwise as functor(i) for each element
+   */
+  template <typename IteratorType, typename Functor>
+  void
+  parallel_for(
+    TaskRunner* task_runner,
+    IteratorType begin,
+    IteratorType end,
+    unsigned long grain,
+    Functor&& functor)
+    /*throw(Gears::Exception)*/;
+
+  /**
+   * Splits [begin, end) into chunks like parallel_for, maps each chunk
+   * into a value and reduces values in the order of chunks.
+   * @param task_runner runner to use
+   * @param begin begin of range
+   * @param end end of range
+   * @param grain number of elements in a chunk, 0 - choose by number of
+   * runner threads
+   * @param identity initial value of reduction
+   * @param map_functor called as map_functor(chunk_begin, chunk_end),
+   * returns value of the chunk
+   * @param reduce_functor called as reduce_functor(left, right),
+   * returns reduced value
+   * @return reduced value
+   */
+  template <
+    typename IteratorType,
+    typename ValueType,
+    typename MapFunctor,
+    typename ReduceFunctor>
+  ValueType
+  parallel_reduce(
+    TaskRunner* task_runner,
+    IteratorType begin,
+    IteratorType end,
+    unsigned long grain,
+    ValueType identity,
+    MapFunctor&& map_functor,
+    ReduceFunctor&& reduce_functor)
+    /*throw(Gears::Exception)*/;
+
+  namespace ParallelHelper
+  {
+    /**
+     * State of parallel execution shared by the caller and helper
+     * tasks. Helper task enqueued into a busy runner can start after
+     * the caller returned: it finds no chunks and doesn't touch
+     * the functor.
+     */
+    template <typename IteratorType, typename ChunkFunctor>
+    class Chunks
+    {
+    public:
+      Chunks(
+        IteratorType begin,
+        unsigned long size,
+        unsigned long grain,
+        ChunkFunctor* functor)
+        noexcept;
+
+      unsigned long
+      count() const noexcept;
+
+      /**
+       * Processes chunks until they are exhausted
+       */
+      void
+      run() noexcept;
+
+      /**
+       * Waits for completion of all chunks, rethrows the first exception
+       */
+      void
+      wait() /*throw(Gears::Exception)*/;
+
+    private:
+      const IteratorType BEGIN_;
+      const unsigned long SIZE_;
+      const unsigned long GRAIN_;
+      const unsigned long COUNT_;
+      ChunkFunctor* const functor_;
+
+      std::atomic<unsigned long> next_chunk_;
+      std::atomic<unsigned long> finished_chunks_;
+      std::atomic<bool> failed_;
+      std::exception_ptr error_;
+      Condition finished_;
+    };
+
+    unsigned long
+    grain(
+      TaskRunner* task_runner,
+      unsigned long size,
+      unsigned long grain)
+      noexcept;
+
+    template <typename IteratorType, typename ChunkFunctor>
+    void
+    run_chunks(
+      TaskRunner* task_runner,
+      IteratorType begin,
+      unsigned long size,
+      unsigned long grain,
+      ChunkFunctor& functor)
+      /*throw(Gears::Exception)*/;
+  }
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  namespace ParallelHelper
+  {
+    //
+    // Chunks class
+    //
+
+    template <typename IteratorType, typename ChunkFunctor>
+    Chunks<IteratorType, ChunkFunctor>::Chunks(
+      IteratorType begin,
+      unsigned long size,
+      unsigned long grain,
+      ChunkFunctor* functor)
+      noexcept
+      : BEGIN_(begin),
+        SIZE_(size),
+        GRAIN_(grain),
+        COUNT_((size + grain - 1) / grain),
+        functor_(functor),
+        next_chunk_(0),
+        finished_chunks_(0),
+        failed_(false)
+    {}
+
+    template <typename IteratorType, typename ChunkFunctor>
+    unsigned long
+    Chunks<IteratorType, ChunkFunctor>::count() const noexcept
+    {
+      return COUNT_;
+    }
+
+    template <typename IteratorType, typename ChunkFunctor>
+    void
+    Chunks<IteratorType, ChunkFunctor>::run() noexcept
+    {
+      for (;;)
+      {
+        const unsigned long chunk =
+          next_chunk_.fetch_add(1, std::memory_order_relaxed);
+
+        if (chunk >= COUNT_)
+        {
+          return;
+        }
+
+        if (!failed_.load(std::memory_order_relaxed))
+        {
+          const unsigned long first = chunk * GRAIN_;
+          const unsigned long last = std::min(first + GRAIN_, SIZE_);
+
+          try
+          {
+            (*functor_)(chunk, BEGIN_ + first, BEGIN_ + last);
+          }
+          catch (...)
+          {
+            Condition::Guard guard(finished_);
+            if (!failed_.load(std::memory_order_relaxed))
+            {
+              error_ = std::current_exception();
+              failed_.store(true, std::memory_order_relaxed);
+            }
+          }
+        }
+
+        if (finished_chunks_.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+            COUNT_)
+        {
+          Condition::Guard guard(finished_);
+          finished_.broadcast();
+        }
+      }
+    }
+
+    template <typename IteratorType, typename ChunkFunctor>
+    void
+    Chunks<IteratorType, ChunkFunctor>::wait() /*throw(Gears::Exception)*/
+    {
+      Condition::Guard guard(finished_);
+
+      while (finished_chunks_.load(std::memory_order_acquire) < COUNT_)
+      {
+        guard.wait();
+      }
+
+      if (error_)
+      {
+        std::rethrow_exception(error_);
+      }
+    }
+
+    inline
+    unsigned long
+    grain(
+      TaskRunner* task_runner,
+      unsigned long size,
+      unsigned long grain)
+      noexcept
+    {
+      if (grain)
+      {
+        return grain;
+      }
+
+      // few chunks per thread for balancing
+      const unsigned long chunks = (task_runner->thread_count() + 1) * 4;
+      return std::max((size + chunks - 1) / chunks, 1ul);
+    }
+
+    template <typename IteratorType, typename ChunkFunctor>
+    void
+    run_chunks(
+      TaskRunner* task_runner,
+      IteratorType begin,
+      unsigned long size,
+      unsigned long grain,
+      ChunkFunctor& functor)
+      /*throw(Gears::Exception)*/
+    {
+      typedef Chunks<IteratorType, ChunkFunctor> ChunksType;
+
+      if (!size)
+      {
+        return;
+      }
+
+      std::shared_ptr<ChunksType> chunks(std::make_shared<ChunksType>(
+        begin,
+        size,
+        ParallelHelper::grain(task_runner, size, grain),
+        &functor));
+
+      // the caller is one of the workers
+      const unsigned long helpers = std::min(
+        chunks->count() - 1,
+        task_runner->thread_count());
+
+      for (unsigned long i = 0; i < helpers; ++i)
+      {
+        try
+        {
+          task_runner->enqueue_task(InlineTask([chunks]() { chunks->run(); }));
+        }
+        catch (...)
+        {
+          // the caller processes the rest and waits for the chunks
+          // taken by enqueued helpers, so functor outlives them
+          break;
+        }
+      }
+
+      chunks->run();
+      chunks->wait();
+    }
+  }
+
+  template <typename IteratorType, typename Functor>
+  void
+  parallel_for(
+    TaskRunner* task_runner,
+    IteratorType begin,
+    IteratorType end,
+    unsigned long grain,
+    Functor&& functor)
+    /*throw(Gears::Exception)*/
+  {
+    auto chunk_functor =
+      [&functor](unsigned long, IteratorType first, IteratorType last)
+      {
+        if constexpr (std::invocable<Functor&, IteratorType, IteratorType>)
+        {
+          functor(first, last);
+        }
+        else
+        {
+          for (; first != last; ++first)
+          {
+            functor(first);
+          }
+        }
+      };
+
+    ParallelHelper::run_chunks(
+      task_runner,
+      begin,
+      static_cast<unsigned long>(end - begin),
+      grain,
+      chunk_functor);
+  }
+
+  template <
+    typename IteratorType,
+    typename ValueType,
+    typename MapFunctor,
+    typename ReduceFunctor>
+  ValueType
+  parallel_reduce(
+    TaskRunner* task_runner,
+    IteratorType begin,
+    IteratorType end,
+    unsigned long grain,
+    ValueType identity,
+    MapFunctor&& map_functor,
+    ReduceFunctor&& reduce_functor)
+    /*throw(Gears::Exception)*/
+  {
+    const unsigned long size = static_cast<unsigned long>(end - begin);
+    const unsigned long chunk_size =
+      ParallelHelper::grain(task_runner, size, grain);
+
+    std::vector<ValueType> values(
+      size ? (size + chunk_size - 1) / chunk_size : 0,
+      identity);
+
+    auto chunk_functor =
+      [&values, &map_functor](
+        unsigned long chunk, IteratorType first, IteratorType last)
+      {
+        values[chunk] = map_functor(first, last);
+      };
+
+    ParallelHelper::run_chunks(
+      task_runner,
+      begin,
+      size,
+      chunk_size,
+      chunk_functor);
+
+    for (auto it = values.begin(); it != values.end(); ++it)
+    {
+      identity = reduce_functor(std::move(identity), std::move(*it));
+    }
+
+    return identity;
+  }
+}
+
+#endif /*GEARS_PARALLEL_HPP_*/
@@ -2,11 +2,20 @@
 #define GEARS_SCHEDULER_HPP_
 
 #include <list>
+#include <memory>
+#include <vector>
 
 #include "ActiveObject.hpp"
+#include "Histogram.hpp"
+#include "SharedExecutor.hpp"
 
 namespace Gears
 {
+  class Goal;
+
+  typedef std::shared_ptr<Goal> Goal_var;
+  typedef std::vector<Goal_var> GoalArray;
+
   class Goal
   {
   public:
@@ -16,28 +25,163 @@ namespace Gears
     virtual
     void
     deliver() /*throw (Gears::Exception)*/ = 0;
-  };
 
-  typedef std::shared_ptr<Goal> Goal_var;
+    /**
+     * Key of batched delivery: expired goals that are adjacent in
+     * the order of due time and have the same not NULL key are
+     * delivered by a single deliver_batch() call of one of them.
+     * Goals with equal keys must be able to deliver each other
+     * (for example, they put themselves into the same TaskRunner).
+     * @return NULL if the goal is delivered by deliver() only
+     */
+    virtual
+    const void*
+    batch_key() const noexcept;
+
+    /**
+     * Delivers the goals with the same batch key, the goal is one
+     * of them. Default implementation calls deliver() of each one.
+     * @param goals not empty array of goals
+     */
+    virtual
+    void
+    deliver_batch(const GoalArray& goals) /*throw (Gears::Exception)*/;
+  };
 
   class Planner: public ActiveObjectCommonImpl
   {
   public:
     DECLARE_EXCEPTION(Exception, ActiveObject::Exception);
 
+    // Awaiter of sleep_until(), defined in Coroutine.hpp
+    class SleepAwaiter;
+
+    /**
+     * Goals queue implementation
+     */
+    enum QueueType
+    {
+      // list sorted by time: O(n) schedule and unschedule
+      QT_LIST,
+      // hierarchical timing wheel with millisecond ticks: O(1) schedule
+      // and unschedule, goals of the same millisecond are delivered
+      // in the order of their time
+      QT_TIMING_WHEEL
+    };
+
+    /**
+     * Clock of goals delivery
+     */
+    enum ClockType
+    {
+      // wall clock, the working thread waits on a condition
+      CT_REALTIME,
+      // CLOCK_MONOTONIC timerfd armed for the first goal: goal times are
+      // converted to the monotonic clock when they are scheduled, so
+      // later wall clock corrections don't move them. The timer can be
+      // watched by an external event loop instead of the working thread
+      // (see descriptor() and deliver_expired()).
+      CT_MONOTONIC
+    };
+
+    /**
+     * Cumulative statistics of the planner since construction
+     */
+    struct Stats
+    {
+      Stats() noexcept;
+
+      // delay of delivery start after the goal time
+      DurationHistogram lateness;
+      // time of deliver() per goal, goals of a batch are counted
+      // with equal parts of deliver_batch() time
+      DurationHistogram delivery;
+      // time the working thread is busy in one loop: taking due goals
+      // from the queue and delivering them
+      DurationHistogram busy;
+      // number of goals in the queue now
+      unsigned long pending_goals;
+      // maximum number of goals in the queue
+      unsigned long max_pending_goals;
+    };
+
+    /**
+     * Handle of a scheduled goal entry. It stays valid after reschedule()
+     * and becomes stale when the entry is delivered or removed:
+     * operations on a stale handle do nothing.
+     */
+    class Handle
+    {
+    public:
+      /**
+       * Constructs handle that doesn't refer to any entry
+       */
+      Handle() noexcept;
+
+      /**
+       * @return false for default constructed handle
+       */
+      explicit
+      operator bool() const noexcept;
+
+    private:
+      friend class Planner;
+
+      explicit
+      Handle(unsigned long long id) noexcept;
+
+      unsigned long long id_;
+    };
+
     /**
      * Constructor
      * @param callback Reference countable callback object to be called
      * for errors
-     * @param stack_size stack size for working thread
+     * @param thread_options options of working thread: stack size,
+     * placement
      * @param delivery_time_adjustment Should delivery_time_shift_ be used
      * for messages' time shift
+     * @param queue_type goals queue implementation
+     * @param clock_type clock of goals delivery
      */
     Planner(
       ActiveObjectCallback_var callback,
-      size_t stack_size = 0,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options(),
+      bool delivery_time_adjustment = false,
+      QueueType queue_type = QT_LIST,
+      ClockType clock_type = CT_REALTIME)
+      /*throw (InvalidArgument, Exception, Gears::Exception)*/;
+
+    /**
+     * Constructor
+     * @param callback Reference countable callback object to be called
+     * for errors
+     * @param stack_size stack size for working thread
+     * @param delivery_time_adjustment see above
+     */
+    Planner(
+      ActiveObjectCallback_var callback,
+      size_t stack_size,
       bool delivery_time_adjustment = false)
-      /*throw (InvalidArgument, Gears::Exception)*/;
+      /*throw (InvalidArgument, Exception, Gears::Exception)*/;
+
+    /**
+     * Constructor of planner without own thread: due goals are
+     * delivered by a thread of the shared executor while the planner
+     * is active. Goals are delivered by one thread at a time on the wall
+     * clock (CT_REALTIME).
+     * @param callback Reference countable callback object to be called
+     * for errors
+     * @param executor not null executor to attach to
+     * @param delivery_time_adjustment see above
+     * @param queue_type goals queue implementation
+     */
+    Planner(
+      ActiveObjectCallback_var callback,
+      SharedExecutor_var executor,
+      bool delivery_time_adjustment = false,
+      QueueType queue_type = QT_LIST)
+      /*throw (InvalidArgument, Exception, Gears::Exception)*/;
 
     /**
      * Destructor
@@ -46,16 +190,64 @@ namespace Gears
     virtual
     ~Planner() noexcept;
 
+    /**
+     * Waits for deactivation completion, for planner attached to
+     * a shared executor waits for the delivery executing now
+     */
+    virtual
+    void
+    wait_object() /*throw (Exception, Gears::Exception)*/;
+
     /**
      * Adds goal to the queue. Goal's reference counter is incremented.
      * On error it is unchanged (and object will be freed in the caller).
      * @param goal Object to enqueue
      * @param time Timestamp to match
+     * @return handle of the entry for unschedule() and reschedule()
      */
-    void
+    Handle
     schedule(Goal_var goal, const Time& time)
       /*throw (InvalidArgument, Exception, Gears::Exception)*/;
 
+    /**
+     * Adds goal delivered periodically. The entry is put back into
+     * the queue after each delivery without allocations, the next time
+     * is counted from the previous planned time, so the period doesn't
+     * drift by delivery delays; periods missed entirely are skipped.
+     * The entry is delivered until it is removed by unschedule()
+     * or clear(), reschedule() moves its next delivery.
+     * @param goal Object to deliver
+     * @param first_time Timestamp of the first delivery
+     * @param period Interval between deliveries, must be positive
+     * @return handle of the entry for unschedule() and reschedule()
+     */
+    Handle
+    schedule_periodic(
+      Goal_var goal,
+      const Time& first_time,
+      const Time& period)
+      /*throw (InvalidArgument, Exception, Gears::Exception)*/;
+
+    /**
+     * Moves the entry to another time: O(1) for QT_TIMING_WHEEL,
+     * O(n) search of the new position for QT_LIST.
+     * @param handle handle returned by schedule()
+     * @param time new timestamp to match
+     * @return false if the entry is already delivered or removed
+     */
+    bool
+    reschedule(const Handle& handle, const Time& time)
+      /*throw (Gears::Exception)*/;
+
+    /**
+     * Awaitable suspending the coroutine until the time:
+     * co_await planner->sleep_until(time) (requires Coroutine.hpp).
+     * The coroutine is resumed in the planner thread.
+     * @param time Timestamp to resume at
+     */
+    SleepAwaiter
+    sleep_until(const Time& time) noexcept;
+
     /**
      * Tries to remove goal from the queue.
      * @param goal Object to remove
@@ -65,6 +257,15 @@ namespace Gears
     unschedule(const Goal* goal)
       /*throw (Gears::Exception)*/;
 
+    /**
+     * Removes the entry in O(1)
+     * @param handle handle returned by schedule()
+     * @return false if the entry is already delivered or removed
+     */
+    bool
+    unschedule(const Handle& handle)
+      /*throw (Gears::Exception)*/;
+
     /**
      * Clearance of messages' queue
      */
@@ -72,15 +273,48 @@ namespace Gears
     void
     clear() /*throw (Gears::Exception)*/;
 
+    /**
+     * Timer descriptor of CT_MONOTONIC planner. It becomes readable
+     * when goals are due, deliver_expired() delivers them and rearms it.
+     * @return -1 for CT_REALTIME planner
+     */
+    int
+    descriptor() const noexcept;
+
+    /**
+     * Delivers due goals of CT_MONOTONIC planner in the calling thread.
+     * Used by an event loop watching descriptor() instead of activation
+     * of the planner: the planner must not be active then.
+     */
+    void
+    deliver_expired() noexcept;
+
+    /**
+     * @return statistics of the planner
+     */
+    Stats
+    stats() const noexcept;
+
   private:
     typedef Gears::Mutex SyncPolicy;
 
-    class PlannerJob: public SingleJob
+    class PlannerJob:
+      public SingleJob,
+      public SharedExecutor::Source
     {
     public:
+      /**
+       * Constructor
+       * @param executor shared executor delivering goals instead of
+       * the working thread, NULL - goals are delivered by own thread
+       */
       PlannerJob(
         ActiveObjectCallback_var callback,
-        bool delivery_time_adjustment) /*throw (Gears::Exception)*/;
+        bool delivery_time_adjustment,
+        QueueType queue_type,
+        ClockType clock_type,
+        SharedExecutor_var executor = SharedExecutor_var())
+        /*throw (Exception, Gears::Exception)*/;
 
       virtual
       ~PlannerJob() noexcept;
@@ -89,21 +323,56 @@ namespace Gears
       void
       work() noexcept;
 
+      virtual
+      void
+      started(unsigned threads) noexcept;
+
       virtual
       void
       terminate() noexcept;
 
+      /**
+       * Delivers due goals in a shared executor thread
+       */
+      virtual
+      void
+      execute_unit() noexcept;
+
+      /**
+       * Waits for the delivery executed by the shared executor
+       * after deactivation
+       */
       void
-      schedule(Goal_var goal, const Time& time)
+      wait_detached() /*throw (Gears::Exception)*/;
+
+      unsigned long long
+      schedule(Goal_var goal, const Time& time, const Time& period)
         /*throw (InvalidArgument, Exception, Gears::Exception)*/;
 
+      bool
+      reschedule(unsigned long long id, const Time& time)
+        /*throw (Gears::Exception)*/;
+
       unsigned
       unschedule(const Goal* goal)
         /*throw (Gears::Exception)*/;
 
+      bool
+      unschedule(unsigned long long id)
+        /*throw (Gears::Exception)*/;
+
       void
       clear() noexcept;
 
+      int
+      descriptor() const noexcept;
+
+      void
+      deliver_expired() noexcept;
+
+      Stats
+      stats() const noexcept;
+
     protected:
       /**
        * Element of messages' queue. Composition of Message and
@@ -120,8 +389,15 @@ namespace Gears
          * Constructor
          * @param time Associated time
          * @param goal Shared ownership on goal
+         * @param id Identifier of the entry
+         * @param period Interval of periodic entry, ZERO for single one
          */
-        TimedMessage(const Time& time, Goal_var goal) noexcept;
+        TimedMessage(
+          const Time& time,
+          Goal_var goal,
+          unsigned long long id = 0,
+          const Time& period = Time::ZERO)
+          noexcept;
 
         /**
          * Holding time
@@ -130,12 +406,27 @@ namespace Gears
         const Time&
         time() const noexcept;
 
+        void
+        time(const Time& time) noexcept;
+
+        unsigned long long
+        id() const noexcept;
+
+        const Time&
+        period() const noexcept;
+
         /**
          * Calls deliver() on owned goal
          */
         void
         deliver() /*throw (Gears::Exception)*/;
 
+        /**
+         * @return owned goal
+         */
+        Goal_var&
+        goal() noexcept;
+
         /**
          * Checks if it holds the goal
          * @param goal goal to check against
@@ -147,20 +438,213 @@ namespace Gears
       private:
         Time time_;
         Goal_var goal_;
+        unsigned long long id_;
+        Time period_;
       };
 
       typedef std::list<TimedMessage> TimedList;
 
+      /**
+       * Storage of scheduled goals, accessed under
+       * new_event_in_schedule_ lock
+       */
+      class GoalQueue
+      {
+      public:
+        virtual
+        ~GoalQueue() noexcept = default;
+
+        /**
+         * Adds the goal
+         * @param id unique identifier of the entry
+         * @param period interval of periodic entry, ZERO for single one
+         * @return true if the working thread should recheck the time
+         * of the first goal
+         */
+        virtual bool
+        push(
+          const Time& time,
+          Goal_var goal,
+          unsigned long long id,
+          const Time& period)
+          /*throw (Gears::Exception)*/ = 0;
+
+        /**
+         * Puts delivered periodic entry back: moves the message from
+         * the list into the queue for the next time, or erases it if
+         * the entry is removed meanwhile
+         * @param now current time, periods before it are skipped
+         * @return true if the working thread should recheck the time
+         * of the first goal
+         */
+        virtual bool
+        reinsert(TimedList& list, TimedList::iterator msg, const Time& now)
+          noexcept = 0;
+
+        /**
+         * Moves the entry to another time
+         * @param recheck set to true if the working thread should
+         * recheck the time of the first goal
+         * @return false if there is no such entry
+         */
+        virtual bool
+        move(unsigned long long id, const Time& time, bool& recheck)
+          noexcept = 0;
+
+        /**
+         * Removes all entries of the goal
+         * @return number of entries removed
+         */
+        virtual unsigned
+        remove(const Goal* goal) noexcept = 0;
+
+        /**
+         * Removes the entry
+         * @return false if there is no such entry
+         */
+        virtual bool
+        remove(unsigned long long id) noexcept = 0;
+
+        /**
+         * Moves goals with time not greater than now to the end of
+         * pending in the order of their time. Periodic entries stay
+         * known to the queue until they are reinserted.
+         */
+        virtual void
+        pop(const Time& now, TimedList& pending)
+          /*throw (Gears::Exception)*/ = 0;
+
+        /**
+         * @param time receiver of the time to check the queue at,
+         * it isn't later than the time of the first goal
+         * @return false if the queue is empty
+         */
+        virtual bool
+        next_time(Time& time) noexcept = 0;
+
+        virtual void
+        clear() noexcept = 0;
+
+        /**
+         * @return number of entries
+         */
+        virtual unsigned long
+        size() const noexcept = 0;
+      };
+
+      typedef std::unique_ptr<GoalQueue> GoalQueue_var;
+
+      class ListGoalQueue;
+      class TimingWheelGoalQueue;
+
+      /**
+       * @param now current time of the queue clock
+       */
+      static
+      GoalQueue_var
+      create_queue_(QueueType queue_type, const Time& now)
+        /*throw (Gears::Exception)*/;
+
+      /**
+       * @return first time of the periodic entry after now
+       */
+      static
+      Time
+      next_period_time_(
+        const Time& time,
+        const Time& period,
+        const Time& now)
+        noexcept;
+
+      /**
+       * Delivers goals taken from the queue in their order: goals
+       * without batch key one by one, each run of adjacent goals with
+       * equal batch keys by one call.
+       * Reinserts periodic entries after that.
+       * @param start time the loop started to take the goals
+       */
+      void
+      deliver_(TimedList& pending, const Time& start) noexcept;
+
+      /**
+       * Removes the first pending entry, periodic one is kept
+       * for reinsertion
+       */
+      void
+      release_pending_(TimedList& pending) noexcept;
+
+      /**
+       * Working loop of CT_MONOTONIC planner: waits for the timer
+       */
+      void
+      work_timer_() /*throw (Gears::Exception)*/;
+
+      /**
+       * Converts wall clock time of a goal to the time of the queue
+       */
+      Time
+      queue_time_(const Time& time) const noexcept;
+
+      /**
+       * Current time of the queue clock
+       */
+      Time
+      current_time_() const noexcept;
+
+      /**
+       * Makes the working thread (or the timer) recheck the first goal,
+       * called under new_event_in_schedule_ lock
+       * @return true if the condition should be signaled
+       */
+      bool
+      wake_() noexcept;
+
+      /**
+       * Arms the timer for the first goal or disarms it if the queue
+       * is empty, called under new_event_in_schedule_ lock
+       */
+      void
+      arm_timer_() noexcept;
+
+      /**
+       * @param time absolute monotonic time, NULL disarms the timer
+       */
+      void
+      set_timer_(const Time* time) noexcept;
+
       mutable Gears::Condition new_event_in_schedule_;
       bool have_new_events_;  // Predicate for condition!
 
-      TimedList messages_;
+      GoalQueue_var messages_;
+      unsigned long long last_id_;
+      // used by the working thread only,
+      // kept between deliveries to reuse its memory
+      GoalArray batch_;
+      TimedList periodic_;
+      DurationRecorder lateness_;
+      DurationRecorder delivery_;
+      DurationRecorder busy_;
+      // changed under new_event_in_schedule_ lock
+      unsigned long max_pending_goals_;
       bool delivery_time_adjustment_;
       Time delivery_time_shift_;
+
+      // CT_MONOTONIC timer, -1 for CT_REALTIME
+      int timer_fd_;
+      bool timer_armed_;
+      Time armed_time_;
+
+      // executor timer replaces timer_fd_ if it is set
+      SharedExecutor_var executor_;
     };
 
     typedef std::shared_ptr<PlannerJob> PlannerJob_var;
 
+    static
+    SharedExecutor_var
+    check_executor_(const SharedExecutor_var& executor)
+      /*throw (InvalidArgument)*/;
+
     PlannerJob& job_;
   };
 
@@ -171,6 +655,17 @@ namespace Gears
 
 namespace Gears
 {
+  //
+  // Goal class
+  //
+
+  inline
+  const void*
+  Goal::batch_key() const noexcept
+  {
+    return 0;
+  }
+
   //
   // Planner::TimedMessage class
   //
@@ -182,9 +677,15 @@ namespace Gears
 
   inline
   Planner::PlannerJob::TimedMessage::TimedMessage(
-    const Time& time, Goal_var goal) noexcept
+    const Time& time,
+    Goal_var goal,
+    unsigned long long id,
+    const Time& period)
+    noexcept
     : time_(time),
-      goal_(std::move(goal))
+      goal_(std::move(goal)),
+      id_(id),
+      period_(period)
   {}
 
   inline
@@ -194,6 +695,27 @@ namespace Gears
     return time_;
   }
 
+  inline
+  void
+  Planner::PlannerJob::TimedMessage::time(const Time& time) noexcept
+  {
+    time_ = time;
+  }
+
+  inline
+  unsigned long long
+  Planner::PlannerJob::TimedMessage::id() const noexcept
+  {
+    return id_;
+  }
+
+  inline
+  const Time&
+  Planner::PlannerJob::TimedMessage::period() const noexcept
+  {
+    return period_;
+  }
+
   inline
   void
   Planner::PlannerJob::TimedMessage::deliver() /*throw (Gears::Exception)*/
@@ -201,6 +723,13 @@ namespace Gears
     goal_->deliver();
   }
 
+  inline
+  Goal_var&
+  Planner::PlannerJob::TimedMessage::goal() noexcept
+  {
+    return goal_;
+  }
+
   inline
   bool
   Planner::PlannerJob::TimedMessage::is_goal(const Goal* goal) const
@@ -210,16 +739,44 @@ namespace Gears
   }
 
 
+  //
+  // Planner::Handle class
+  //
+
+  inline
+  Planner::Handle::Handle() noexcept
+    : id_(0)
+  {}
+
+  inline
+  Planner::Handle::Handle(unsigned long long id) noexcept
+    : id_(id)
+  {}
+
+  inline
+  Planner::Handle::operator bool() const noexcept
+  {
+    return id_ != 0;
+  }
+
   //
   // Planner class
   //
 
   inline
-  void
+  Planner::Handle
   Planner::schedule(Goal_var goal, const Time& time)
     /*throw (InvalidArgument, Exception, Gears::Exception)*/
   {
-    job_.schedule(std::move(goal), time);
+    return Handle(job_.schedule(std::move(goal), time, Time::ZERO));
+  }
+
+  inline
+  bool
+  Planner::reschedule(const Handle& handle, const Time& time)
+    /*throw (Gears::Exception)*/
+  {
+    return handle.id_ && job_.reschedule(handle.id_, time);
   }
 
   inline
@@ -230,12 +787,41 @@ namespace Gears
     return job_.unschedule(goal);
   }
 
+  inline
+  bool
+  Planner::unschedule(const Handle& handle)
+    /*throw (Gears::Exception)*/
+  {
+    return handle.id_ && job_.unschedule(handle.id_);
+  }
+
   inline
   void
   Planner::clear() /*throw (Gears::Exception)*/
   {
     job_.clear();
   }
+
+  inline
+  int
+  Planner::descriptor() const noexcept
+  {
+    return job_.descriptor();
+  }
+
+  inline
+  void
+  Planner::deliver_expired() noexcept
+  {
+    job_.deliver_expired();
+  }
+
+  inline
+  Planner::Stats
+  Planner::stats() const noexcept
+  {
+    return job_.stats();
+  }
 }
 
 #endif
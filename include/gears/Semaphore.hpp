@@ -3,6 +3,9 @@
 
 #include <semaphore.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "Errno.hpp"
 #include "Uncopyable.hpp"
 #include "Time.hpp"
@@ -41,6 +44,12 @@ namespace Gears
     void
     release() /*throw (Exception)*/;
 
+    /**
+     * Increases counter by count and wakes up to count waiters
+     */
+    void
+    release(int count) /*throw (Exception)*/;
+
     int
     value() /*throw (Exception)*/;
 
@@ -48,6 +57,63 @@ namespace Gears
     Condition condition_lock_;
     int count_;
   };
+
+  /**
+   * @class AtomicSemaphore
+   *
+   * @brief Semaphore with lock free fast path
+   *
+   * Counter is kept in an atomic, negative value means number of
+   * blocked waiters. Underlying Semaphore is touched only when
+   * acquire() should block or release() should wake a waiter,
+   * so uncontended acquire/release pair costs two atomic operations.
+   */
+  class AtomicSemaphore: private Uncopyable
+  {
+  public:
+    typedef Semaphore::Exception Exception;
+
+    explicit
+    AtomicSemaphore(int count) /*throw (Exception)*/;
+
+    ~AtomicSemaphore() noexcept;
+
+    void
+    acquire() /*throw (Exception)*/;
+
+    bool
+    try_acquire() /*throw (Exception)*/;
+
+    /**
+     * Decreases counter by count if it is not less than count
+     * @return false if counter is less than count (it is unchanged)
+     */
+    bool
+    try_acquire(int count) /*throw (Exception)*/;
+
+    bool
+    timed_acquire(const Time* time, bool time_is_relative = false)
+      /*throw (Exception)*/;
+
+    void
+    release() /*throw (Exception)*/;
+
+    /**
+     * Increases counter by count, wakes only waiters that can take it
+     */
+    void
+    release(int count) /*throw (Exception)*/;
+
+    /**
+     * Current counter, negative if there are blocked waiters
+     */
+    int
+    value() /*throw (Exception)*/;
+
+  private:
+    std::atomic<int> count_;
+    Semaphore wait_semaphore_;
+  };
 }
 
 namespace Gears
@@ -132,6 +198,22 @@ namespace Gears
     condition_lock_.signal();
   }
 
+  inline
+  void
+  Semaphore::release(int count) /*throw (Exception)*/
+  {
+    {
+      Condition::Guard lock(condition_lock_);
+      count_ += count;
+    }
+
+    // wake exactly as many waiters as can proceed
+    for(int i = 0; i < count; ++i)
+    {
+      condition_lock_.signal();
+    }
+  }
+
   inline
   int
   Semaphore::value() /*throw (Exception)*/
@@ -139,6 +221,129 @@ namespace Gears
     Condition::Guard lock(condition_lock_);
     return count_;
   }
+
+  //
+  // AtomicSemaphore class
+  //
+
+  inline
+  AtomicSemaphore::AtomicSemaphore(int count) /*throw (Exception)*/
+    : count_(count),
+      wait_semaphore_(0)
+  {}
+
+  inline
+  AtomicSemaphore::~AtomicSemaphore() noexcept
+  {}
+
+  inline
+  void
+  AtomicSemaphore::acquire() /*throw (Exception)*/
+  {
+    if(count_.fetch_sub(1, std::memory_order_acquire) <= 0)
+    {
+      wait_semaphore_.acquire();
+    }
+  }
+
+  inline
+  bool
+  AtomicSemaphore::try_acquire() /*throw (Exception)*/
+  {
+    int count = count_.load(std::memory_order_relaxed);
+
+    while(count > 0)
+    {
+      if(count_.compare_exchange_weak(
+           count, count - 1, std::memory_order_acquire))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  inline
+  bool
+  AtomicSemaphore::try_acquire(int count) /*throw (Exception)*/
+  {
+    int value = count_.load(std::memory_order_relaxed);
+
+    while(value >= count)
+    {
+      if(count_.compare_exchange_weak(
+           value, value - count, std::memory_order_acquire))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  inline
+  bool
+  AtomicSemaphore::timed_acquire(
+    const Time* time,
+    bool time_is_relative)
+    /*throw (Exception)*/
+  {
+    if(count_.fetch_sub(1, std::memory_order_acquire) > 0)
+    {
+      return true;
+    }
+
+    if(wait_semaphore_.timed_acquire(time, time_is_relative))
+    {
+      return true;
+    }
+
+    // timed out: withdraw the waiter registration unless release()
+    // has already accounted it, in that case its wakeup is ours
+    int count = count_.load(std::memory_order_relaxed);
+
+    while(count < 0)
+    {
+      if(count_.compare_exchange_weak(
+           count, count + 1, std::memory_order_relaxed))
+      {
+        return false;
+      }
+    }
+
+    wait_semaphore_.acquire();
+    return true;
+  }
+
+  inline
+  void
+  AtomicSemaphore::release() /*throw (Exception)*/
+  {
+    if(count_.fetch_add(1, std::memory_order_release) < 0)
+    {
+      wait_semaphore_.release();
+    }
+  }
+
+  inline
+  void
+  AtomicSemaphore::release(int count) /*throw (Exception)*/
+  {
+    const int prev = count_.fetch_add(count, std::memory_order_release);
+
+    if(prev < 0)
+    {
+      wait_semaphore_.release(std::min(-prev, count));
+    }
+  }
+
+  inline
+  int
+  AtomicSemaphore::value() /*throw (Exception)*/
+  {
+    return count_.load(std::memory_order_relaxed);
+  }
 }
 
 #endif
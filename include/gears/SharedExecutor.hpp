@@ -0,0 +1,172 @@
+#ifndef GEARS_SHAREDEXECUTOR_HPP_
+#define GEARS_SHAREDEXECUTOR_HPP_
+
+#include <memory>
+
+#include "Time.hpp"
+#include "Lock.hpp"
+#include "Condition.hpp"
+#include "ActiveObject.hpp"
+
+namespace Gears
+{
+  /**
+   * Pool of threads shared by several TaskRunner and Planner objects
+   * attached to it (sources), so a process with many components keeps
+   * a single pool about the core count instead of a pool per component.
+   * Work of a source is counted in units, a unit is executed by
+   * Source::execute_unit() in one of the executor threads. Sources with
+   * pending units are served round robin: a source executes up to its
+   * weight units in a row while others wait. A source can request
+   * a unit at an absolute wall clock time (timer), one of idle threads
+   * waits for the nearest timer.
+   * A source keeps its pending units and timer while it is detached,
+   * they are served after it is attached again.
+   */
+  class SharedExecutor: public ActiveObjectCommonImpl
+  {
+  public:
+    /**
+     * Queue of work attached to the executor. The state used by
+     * the executor is changed under the executor lock.
+     */
+    class Source
+    {
+    public:
+      /**
+       * Constructor
+       * @param weight number of units executed in a row while other
+       * sources have pending units, 0 is counted as 1
+       * @param serial units are executed one at a time
+       */
+      Source(unsigned long weight, bool serial) noexcept;
+
+      virtual
+      ~Source() noexcept = default;
+
+      /**
+       * Executes one unit of work in an executor thread
+       */
+      virtual void
+      execute_unit() noexcept = 0;
+
+    private:
+      friend class SharedExecutor;
+
+      const unsigned long WEIGHT_;
+      const bool SERIAL_;
+
+      bool attached_;
+      unsigned long pending_;
+      unsigned long executing_;
+      bool timer_set_;
+      Time timer_;
+
+      // ring of sources with pending units, NULL if not in the ring
+      Source* prev_;
+      Source* next_;
+    };
+
+    /**
+     * Constructor
+     * @param callback not null callback is called on errors
+     * @param threads_number number of threads, 0 - number of cores
+     * @param thread_options options of threads: stack size, placement
+     */
+    explicit
+    SharedExecutor(
+      ActiveObjectCallback_var callback,
+      unsigned int threads_number = 0,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options())
+      /*throw(InvalidArgument, Exception, Gears::Exception)*/;
+
+    virtual
+    ~SharedExecutor() noexcept;
+
+    /**
+     * Starts serving units of the source
+     * @param source source that isn't attached
+     */
+    void
+    attach(Source* source) noexcept;
+
+    /**
+     * Stops serving units of the source, units executing now
+     * are not waited for (see wait_detached())
+     * @param source attached or detached source
+     */
+    void
+    detach(Source* source) noexcept;
+
+    /**
+     * Waits until the source is detached and none of its units
+     * is executing. Must not be called from a unit of the source.
+     * @param source source to wait for
+     */
+    void
+    wait_detached(Source* source) /*throw(Gears::Exception)*/;
+
+    /**
+     * Adds pending units to the source
+     * @param source attached or detached source
+     * @param units number of units
+     */
+    void
+    post(Source* source, unsigned long units = 1) noexcept;
+
+    /**
+     * Sets the time of the next unit requested by the source, a unit
+     * is added when the time comes. Serial source gets no unit if it
+     * has a pending one.
+     * @param source attached or detached source
+     * @param time absolute time, NULL - cancel the timer
+     */
+    void
+    set_timer(Source* source, const Time* time) noexcept;
+
+    /**
+     * @return number of executor threads
+     */
+    unsigned long
+    thread_count() const noexcept;
+
+  private:
+    class ExecutorJob;
+
+    typedef std::shared_ptr<ExecutorJob> ExecutorJob_var;
+
+    static
+    unsigned int
+    threads_(unsigned int threads_number) noexcept;
+
+  private:
+    ExecutorJob& job_;
+  };
+
+  typedef std::shared_ptr<SharedExecutor> SharedExecutor_var;
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  //
+  // SharedExecutor::Source class
+  //
+
+  inline
+  SharedExecutor::Source::Source(unsigned long weight, bool serial) noexcept
+    : WEIGHT_(weight ? weight : 1),
+      SERIAL_(serial),
+      attached_(false),
+      pending_(0),
+      executing_(0),
+      timer_set_(false),
+      prev_(0),
+      next_(0)
+  {}
+}
+
+#endif /*GEARS_SHAREDEXECUTOR_HPP_*/
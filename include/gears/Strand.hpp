@@ -0,0 +1,581 @@
+#ifndef GEARS_STRAND_HPP_
+#define GEARS_STRAND_HPP_
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include "Exception.hpp"
+#include "Uncopyable.hpp"
+#include "Lock.hpp"
+#include "Condition.hpp"
+#include "InlineTask.hpp"
+#include "TaskRunner.hpp"
+
+namespace Gears
+{
+  /**
+   * Keyed serial executor over TaskRunner.
+   * Tasks with the same key are executed one by one in the order of
+   * enqueueing, tasks with different keys are executed in parallel by
+   * the runner threads. A key with pending tasks (strand) occupies at
+   * most one runner task: it is enqueued when the first task of the key
+   * arrives and executes up to tasks_per_turn tasks of the key before
+   * it is enqueued again to let other keys run. Waiting tasks hold
+   * neither a lock nor a thread. A strand without tasks is removed.
+   * Strands are distributed over shards by key hash, each shard has
+   * own lock taken only to push and pop tasks.
+   * If the runner rejects a continuation with Overflow, the strand
+   * continues in the current thread; if the continuation can't be
+   * enqueued for another reason, the strand is stopped with its tasks
+   * and is restarted by the next enqueue of the key. An exception of
+   * a task doesn't stop the strand, the first exception of a turn is
+   * rethrown to the runner after it.
+   * Executor must outlive the runner tasks it enqueued: destructor waits
+   * for execution of all tasks. A strand dropped by TaskRunner::clear()
+   * is stopped with its tasks as if its continuation was rejected.
+   */
+  template <typename KeyType, typename HashType = std::hash<KeyType>>
+  class StrandExecutor: private Uncopyable
+  {
+  public:
+    DECLARE_EXCEPTION(Exception, Gears::DescriptiveException);
+    DECLARE_EXCEPTION(InvalidArgument, Exception);
+
+    /**
+     * Constructor
+     * @param task_runner runner to execute tasks on
+     * @param tasks_per_turn maximum number of tasks of a key executed
+     * by a runner task
+     * @param shards number of independently locked parts of key map
+     */
+    explicit
+    StrandExecutor(
+      TaskRunner* task_runner,
+      unsigned long tasks_per_turn = 16,
+      unsigned long shards = 16)
+      /*throw(InvalidArgument, Gears::Exception)*/;
+
+    /**
+     * Destructor, waits for execution of enqueued tasks
+     */
+    ~StrandExecutor() noexcept;
+
+    /**
+     * Enqueues the task into the strand of the key
+     * @param key key of the strand
+     * @param task not empty task
+     */
+    void
+    enqueue_task(const KeyType& key, InlineTask task)
+      /*throw(InvalidArgument, TaskRunner::Overflow, TaskRunner::NotActive,
+        Gears::Exception)*/;
+
+    void
+    enqueue_task(const KeyType& key, Task_var task)
+      /*throw(InvalidArgument, TaskRunner::Overflow, TaskRunner::NotActive,
+        Gears::Exception)*/;
+
+    /**
+     * @return number of keys with pending or executed tasks
+     */
+    unsigned long
+    strand_count() const noexcept;
+
+    /**
+     * Waits for execution of all enqueued tasks
+     * @param timeout absolute time or interval (see time_is_relative),
+     * NULL timeout means infinite wait
+     * @param time_is_relative timeout is an interval
+     * @return false if timeout is reached
+     */
+    bool
+    wait(const Time* timeout = 0, bool time_is_relative = false)
+      /*throw(Gears::Exception)*/;
+
+  private:
+    struct Shard;
+
+    struct Strand
+    {
+      Strand(Shard* shard_val, const KeyType& key_val)
+        /*throw(Gears::Exception)*/;
+
+      Shard* shard;
+      KeyType key;
+      std::deque<InlineTask> tasks;
+      // a runner task is enqueued or executes the strand
+      bool scheduled;
+      // EnqueueState, resolves drop of the runner task inside schedule_
+      std::atomic<unsigned char> enqueue_state;
+    };
+
+    enum EnqueueState
+    {
+      ES_NONE,
+      ES_ENQUEUING,
+      ES_DROPPED
+    };
+
+    typedef std::unordered_map<KeyType, Strand, HashType> StrandMap;
+
+    struct Shard
+    {
+      typedef Gears::Mutex SyncPolicy;
+
+      SyncPolicy lock;
+      StrandMap strands;
+    };
+
+    /**
+     * Functor enqueued into TaskRunner
+     */
+    struct StrandCall
+    {
+      StrandCall(StrandExecutor* executor_val, Strand* strand_val) noexcept;
+
+      StrandCall(StrandCall&& other) noexcept;
+
+      StrandCall(const StrandCall&) = delete;
+
+      /**
+       * Stops the strand if it wasn't called
+       */
+      ~StrandCall() noexcept;
+
+      void
+      operator()() /*throw(Gears::Exception)*/;
+
+      // null after the call or move
+      StrandExecutor* executor;
+      Strand* strand;
+    };
+
+    /**
+     * Enqueues the strand into the runner. If the runner drops the
+     * strand before the return, it is stopped by the call.
+     */
+    void
+    schedule_(Strand* strand)
+      /*throw(TaskRunner::Overflow, TaskRunner::NotActive, Gears::Exception)*/;
+
+    /**
+     * Stops the strand whose runner task is dropped, keeps its tasks
+     * for the next enqueue of the key
+     */
+    void
+    strand_dropped_(Strand* strand) noexcept;
+
+    void
+    stop_dropped_(Strand* strand) noexcept;
+
+    /**
+     * Executes tasks of the strand, reschedules or removes it.
+     * Rethrows the exception of a task after that.
+     */
+    void
+    run_strand_(Strand* strand) /*throw(Gears::Exception)*/;
+
+    /**
+     * Accounts the strand that isn't scheduled anymore, wakes waiters
+     * when the last one is stopped. The executor can be destroyed
+     * after the call.
+     */
+    void
+    strand_stopped_() noexcept;
+
+  private:
+    TaskRunner* const task_runner_;
+    const unsigned long TASKS_PER_TURN_;
+    const HashType hash_;
+    std::unique_ptr<Shard[]> shards_;
+    const unsigned long SHARDS_;
+
+    std::atomic<unsigned long> scheduled_strands_;
+    std::atomic<unsigned long> strand_count_;
+    Condition idle_;
+  };
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  //
+  // StrandExecutor::Strand class
+  //
+
+  template <typename KeyType, typename HashType>
+  StrandExecutor<KeyType, HashType>::Strand::Strand(
+    Shard* shard_val, const KeyType& key_val)
+    /*throw(Gears::Exception)*/
+    : shard(shard_val),
+      key(key_val),
+      scheduled(false),
+      enqueue_state(ES_NONE)
+  {}
+
+  //
+  // StrandExecutor::StrandCall class
+  //
+
+  template <typename KeyType, typename HashType>
+  StrandExecutor<KeyType, HashType>::StrandCall::StrandCall(
+    StrandExecutor* executor_val, Strand* strand_val) noexcept
+    : executor(executor_val),
+      strand(strand_val)
+  {}
+
+  template <typename KeyType, typename HashType>
+  StrandExecutor<KeyType, HashType>::StrandCall::StrandCall(
+    StrandCall&& other) noexcept
+    : executor(other.executor),
+      strand(other.strand)
+  {
+    other.executor = 0;
+  }
+
+  template <typename KeyType, typename HashType>
+  StrandExecutor<KeyType, HashType>::StrandCall::~StrandCall() noexcept
+  {
+    if (executor)
+    {
+      executor->strand_dropped_(strand);
+    }
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::StrandCall::operator()()
+    /*throw(Gears::Exception)*/
+  {
+    // the executor can be destroyed after run_strand_
+    StrandExecutor* const run_executor = executor;
+    executor = 0;
+    run_executor->run_strand_(strand);
+  }
+
+  //
+  // StrandExecutor class
+  //
+
+  template <typename KeyType, typename HashType>
+  StrandExecutor<KeyType, HashType>::StrandExecutor(
+    TaskRunner* task_runner,
+    unsigned long tasks_per_turn,
+    unsigned long shards)
+    /*throw(InvalidArgument, Gears::Exception)*/
+    : task_runner_(task_runner),
+      TASKS_PER_TURN_(tasks_per_turn),
+      hash_(),
+      SHARDS_(shards),
+      scheduled_strands_(0),
+      strand_count_(0)
+  {
+    static const char* FUN = "StrandExecutor::StrandExecutor()";
+
+    if (!task_runner || !tasks_per_turn || !shards)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task runner is NULL or zero tasks per turn or shards";
+      throw InvalidArgument(ostr.str());
+    }
+
+    shards_.reset(new Shard[shards]);
+  }
+
+  template <typename KeyType, typename HashType>
+  StrandExecutor<KeyType, HashType>::~StrandExecutor() noexcept
+  {
+    try
+    {
+      wait();
+    }
+    catch (...)
+    {}
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::enqueue_task(
+    const KeyType& key, InlineTask task)
+    /*throw(InvalidArgument, TaskRunner::Overflow, TaskRunner::NotActive,
+      Gears::Exception)*/
+  {
+    static const char* FUN = "StrandExecutor::enqueue_task()";
+
+    if (!task)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    Shard& shard = shards_[hash_(key) % SHARDS_];
+    Strand* strand;
+    unsigned long position;
+
+    {
+      typename Shard::SyncPolicy::WriteGuard guard(shard.lock);
+
+      auto ins = shard.strands.try_emplace(key, &shard, key);
+      strand = &ins.first->second;
+
+      if (ins.second)
+      {
+        strand_count_.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      position = strand->tasks.size();
+      strand->tasks.push_back(std::move(task));
+
+      if (strand->scheduled)
+      {
+        return;
+      }
+
+      strand->scheduled = true;
+    }
+
+    scheduled_strands_.fetch_add(1, std::memory_order_relaxed);
+
+    try
+    {
+      schedule_(strand);
+    }
+    catch (...)
+    {
+      // remove the task: the strand is stopped, tasks pushed by others
+      // meanwhile are kept for the next enqueue
+      {
+        typename Shard::SyncPolicy::WriteGuard guard(shard.lock);
+
+        strand->tasks.erase(strand->tasks.begin() + position);
+        strand->scheduled = false;
+
+        if (strand->tasks.empty())
+        {
+          shard.strands.erase(key);
+          strand_count_.fetch_sub(1, std::memory_order_relaxed);
+        }
+      }
+
+      strand_stopped_();
+      throw;
+    }
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::enqueue_task(
+    const KeyType& key, Task_var task)
+    /*throw(InvalidArgument, TaskRunner::Overflow, TaskRunner::NotActive,
+      Gears::Exception)*/
+  {
+    static const char* FUN = "StrandExecutor::enqueue_task()";
+
+    if (!task)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    enqueue_task(key, InlineTask([task]() { task->execute(); }));
+  }
+
+  template <typename KeyType, typename HashType>
+  unsigned long
+  StrandExecutor<KeyType, HashType>::strand_count() const noexcept
+  {
+    return strand_count_.load(std::memory_order_relaxed);
+  }
+
+  template <typename KeyType, typename HashType>
+  bool
+  StrandExecutor<KeyType, HashType>::wait(
+    const Time* timeout, bool time_is_relative)
+    /*throw(Gears::Exception)*/
+  {
+    const Time end_time(
+      timeout && time_is_relative ?
+      Time::get_time_of_day() + *timeout :
+      (timeout ? *timeout : Time::ZERO));
+
+    Condition::Guard guard(idle_);
+
+    while (scheduled_strands_.load(std::memory_order_acquire))
+    {
+      if (!guard.timed_wait(timeout ? &end_time : 0))
+      {
+        return !scheduled_strands_.load(std::memory_order_acquire);
+      }
+    }
+
+    return true;
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::schedule_(Strand* strand)
+    /*throw(TaskRunner::Overflow, TaskRunner::NotActive, Gears::Exception)*/
+  {
+    // the rejected runner task is destroyed inside enqueue_task(),
+    // strand_dropped_ leaves it to the caller
+    strand->enqueue_state.store(ES_ENQUEUING, std::memory_order_relaxed);
+
+    try
+    {
+      task_runner_->enqueue_task(InlineTask(StrandCall(this, strand)));
+    }
+    catch (...)
+    {
+      strand->enqueue_state.store(ES_NONE, std::memory_order_relaxed);
+      throw;
+    }
+
+    if (strand->enqueue_state.exchange(ES_NONE, std::memory_order_acq_rel) ==
+        ES_DROPPED)
+    {
+      // dropped by clear() before the return
+      stop_dropped_(strand);
+    }
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::strand_dropped_(Strand* strand) noexcept
+  {
+    if (strand->enqueue_state.exchange(
+          ES_DROPPED, std::memory_order_acq_rel) != ES_ENQUEUING)
+    {
+      stop_dropped_(strand);
+    }
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::stop_dropped_(Strand* strand) noexcept
+  {
+    Shard& shard = *strand->shard;
+
+    {
+      typename Shard::SyncPolicy::WriteGuard guard(shard.lock);
+
+      strand->scheduled = false;
+
+      if (strand->tasks.empty())
+      {
+        shard.strands.erase(strand->key);
+        strand_count_.fetch_sub(1, std::memory_order_relaxed);
+      }
+    }
+
+    // the executor can be destroyed after this call
+    strand_stopped_();
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::run_strand_(Strand* strand)
+    /*throw(Gears::Exception)*/
+  {
+    Shard& shard = *strand->shard;
+    std::exception_ptr error;
+
+    for (;;)
+    {
+      // only the thread executing the scheduled strand pops its tasks
+      for (unsigned long i = 0; i < TASKS_PER_TURN_; ++i)
+      {
+        InlineTask task;
+
+        {
+          typename Shard::SyncPolicy::WriteGuard guard(shard.lock);
+
+          if (strand->tasks.empty())
+          {
+            break;
+          }
+
+          task = std::move(strand->tasks.front());
+          strand->tasks.pop_front();
+        }
+
+        try
+        {
+          task();
+        }
+        catch (...)
+        {
+          if (!error)
+          {
+            error = std::current_exception();
+          }
+        }
+      }
+
+      bool stopped = false;
+
+      {
+        typename Shard::SyncPolicy::WriteGuard guard(shard.lock);
+
+        if (strand->tasks.empty())
+        {
+          shard.strands.erase(strand->key);
+          strand_count_.fetch_sub(1, std::memory_order_relaxed);
+          stopped = true;
+        }
+      }
+
+      if (!stopped)
+      {
+        try
+        {
+          schedule_(strand);
+          break;
+        }
+        catch (const TaskRunner::Overflow&)
+        {
+          // continue in this thread
+          continue;
+        }
+        catch (...)
+        {
+          // the next enqueue restarts the strand
+          typename Shard::SyncPolicy::WriteGuard guard(shard.lock);
+          strand->scheduled = false;
+        }
+      }
+
+      // the executor can be destroyed after this call
+      strand_stopped_();
+      break;
+    }
+
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  template <typename KeyType, typename HashType>
+  void
+  StrandExecutor<KeyType, HashType>::strand_stopped_() noexcept
+  {
+    if (scheduled_strands_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      // waiter rechecks the counter under the lock, so the executor
+      // isn't destroyed before the broadcast
+      Condition::Guard guard(idle_);
+      idle_.broadcast();
+    }
+  }
+}
+
+#endif /*GEARS_STRAND_HPP_*/
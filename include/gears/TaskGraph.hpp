@@ -0,0 +1,284 @@
+#ifndef GEARS_TASKGRAPH_HPP_
+#define GEARS_TASKGRAPH_HPP_
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "Exception.hpp"
+#include "Uncopyable.hpp"
+#include "Condition.hpp"
+#include "InlineTask.hpp"
+#include "TaskRunner.hpp"
+
+namespace Gears
+{
+  /**
+   * Directed acyclic graph of tasks executed by TaskRunner.
+   * A task is enqueued into the runner as soon as its last dependency
+   * finishes: each task keeps an atomic counter of unfinished
+   * dependencies, the task finishing last releases it, no common lock
+   * is taken. If a task throws, the exception is reported by the runner
+   * and all tasks depending on it are skipped. If the runner rejects
+   * a released task (Overflow, NotActive or another error), the task
+   * is executed by the releasing thread.
+   * The graph can be submitted again after completion. It must not be
+   * changed while it is executed, destructor waits for the execution.
+   * Tasks of the graph dropped by TaskRunner::clear() are accounted
+   * as failed, tasks depending on them are skipped.
+   */
+  class TaskGraph: private Uncopyable
+  {
+  public:
+    DECLARE_EXCEPTION(Exception, Gears::DescriptiveException);
+    DECLARE_EXCEPTION(InvalidArgument, Exception);
+    DECLARE_EXCEPTION(AlreadySubmitted, Exception);
+
+    typedef unsigned long NodeId;
+
+    TaskGraph() noexcept;
+
+    /**
+     * Destructor, waits for completion of submitted graph
+     */
+    ~TaskGraph() noexcept;
+
+    /**
+     * Adds a task without dependencies
+     * @param task not empty task
+     * @return identifier of the task in the graph
+     */
+    NodeId
+    add_task(InlineTask task)
+      /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/;
+
+    NodeId
+    add_task(Task_var task)
+      /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/;
+
+    /**
+     * Makes the task wait for the dependency
+     * @param task task to execute after the dependency
+     * @param dependency task to execute before
+     */
+    void
+    add_dependency(NodeId task, NodeId dependency)
+      /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/;
+
+    /**
+     * @return number of tasks in the graph
+     */
+    unsigned long
+    size() const noexcept;
+
+    /**
+     * Enqueues tasks without dependencies into the runner, the rest
+     * are enqueued as they are released.
+     * @param task_runner runner to execute the graph on
+     */
+    void
+    submit(TaskRunner* task_runner)
+      /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/;
+
+    /**
+     * Waits for completion of all tasks of the graph
+     * @param timeout absolute time or interval (see time_is_relative),
+     * NULL timeout means infinite wait
+     * @param time_is_relative timeout is an interval
+     * @return false if timeout is reached
+     */
+    bool
+    wait(const Time* timeout = 0, bool time_is_relative = false)
+      /*throw(Gears::Exception)*/;
+
+    /**
+     * @return true if the graph isn't executed now
+     */
+    bool
+    done() const noexcept;
+
+    /**
+     * @return number of failed and skipped tasks of the last execution
+     */
+    unsigned long
+    failed() const noexcept;
+
+  private:
+    struct Node
+    {
+      explicit
+      Node(InlineTask task_val) noexcept;
+
+      InlineTask task;
+      std::vector<NodeId> successors;
+      unsigned long dependencies;
+
+      // execution state
+      std::atomic<unsigned long> pending;
+      std::atomic<bool> skipped;
+      // EnqueueState, resolves drop of the task inside enqueue_node_
+      std::atomic<unsigned char> enqueue_state;
+    };
+
+    enum EnqueueState
+    {
+      ES_NONE,
+      ES_ENQUEUING,
+      ES_DROPPED
+    };
+
+    typedef std::deque<Node> NodeArray;
+
+    /**
+     * Functor enqueued into TaskRunner
+     */
+    struct NodeCall
+    {
+      NodeCall(TaskGraph* graph_val, NodeId id_val) noexcept;
+
+      NodeCall(NodeCall&& other) noexcept;
+
+      NodeCall(const NodeCall&) = delete;
+
+      /**
+       * Accounts the task as dropped if it wasn't called
+       */
+      ~NodeCall() noexcept;
+
+      void
+      operator()() /*throw(Gears::Exception)*/;
+
+      // null after the call or move
+      TaskGraph* graph;
+      NodeId id;
+    };
+
+    void
+    check_not_submitted_(const char* fun) const
+      /*throw(AlreadySubmitted)*/;
+
+    /**
+     * Executes the task and all tasks released by it that can't be
+     * enqueued, enqueues other released tasks. Rethrows the exception
+     * of the task after accounting.
+     */
+    void
+    run_node_(NodeId id) /*throw(Gears::Exception)*/;
+
+    /**
+     * Enqueues the task
+     * @return false if the runner rejected the task or dropped it
+     * before the return, in the last case the task is marked skipped
+     */
+    bool
+    enqueue_node_(NodeId id) noexcept;
+
+    /**
+     * Finishes the task dropped by the runner as skipped
+     */
+    void
+    node_dropped_(NodeId id) noexcept;
+
+    /**
+     * Accounts finished tasks, wakes waiters on completion.
+     * The graph can be destroyed after the call.
+     */
+    void
+    nodes_finished_(unsigned long count) noexcept;
+
+  private:
+    NodeArray nodes_;
+    TaskRunner* task_runner_;
+
+    std::atomic<unsigned long> remaining_;
+    std::atomic<unsigned long> failed_;
+    // set under done_ lock when the last task is finished
+    std::atomic<bool> completed_;
+    Condition done_;
+  };
+}
+
+//
+// Inlines
+//
+
+namespace Gears
+{
+  //
+  // TaskGraph::Node class
+  //
+
+  inline
+  TaskGraph::Node::Node(InlineTask task_val) noexcept
+    : task(std::move(task_val)),
+      dependencies(0),
+      pending(0),
+      skipped(false),
+      enqueue_state(ES_NONE)
+  {}
+
+  //
+  // TaskGraph::NodeCall class
+  //
+
+  inline
+  TaskGraph::NodeCall::NodeCall(TaskGraph* graph_val, NodeId id_val)
+    noexcept
+    : graph(graph_val),
+      id(id_val)
+  {}
+
+  inline
+  TaskGraph::NodeCall::NodeCall(NodeCall&& other) noexcept
+    : graph(other.graph),
+      id(other.id)
+  {
+    other.graph = 0;
+  }
+
+  inline
+  TaskGraph::NodeCall::~NodeCall() noexcept
+  {
+    if (graph)
+    {
+      graph->node_dropped_(id);
+    }
+  }
+
+  inline
+  void
+  TaskGraph::NodeCall::operator()() /*throw(Gears::Exception)*/
+  {
+    // the graph can be destroyed after run_node_
+    TaskGraph* const run_graph = graph;
+    graph = 0;
+    run_graph->run_node_(id);
+  }
+
+  //
+  // TaskGraph class
+  //
+
+  inline
+  unsigned long
+  TaskGraph::size() const noexcept
+  {
+    return nodes_.size();
+  }
+
+  inline
+  bool
+  TaskGraph::done() const noexcept
+  {
+    return completed_.load(std::memory_order_acquire);
+  }
+
+  inline
+  unsigned long
+  TaskGraph::failed() const noexcept
+  {
+    return failed_.load(std::memory_order_relaxed);
+  }
+}
+
+#endif /*GEARS_TASKGRAPH_HPP_*/
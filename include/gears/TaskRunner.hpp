@@ -1,14 +1,19 @@
 #ifndef GEARS_THREADING_TASKRUNNER_HPP
 #define GEARS_THREADING_TASKRUNNER_HPP
 
+#include <atomic>
 #include <deque>
 #include <memory>
+#include <vector>
 
 #include "Exception.hpp"
 #include "Lock.hpp"
 
 #include "Semaphore.hpp"
+#include "InlineTask.hpp"
 #include "ActiveObject.hpp"
+#include "Histogram.hpp"
+#include "SharedExecutor.hpp"
 #include "Planner.hpp"
 
 namespace Gears
@@ -31,6 +36,83 @@ namespace Gears
 
   typedef std::shared_ptr<Task> Task_var;
 
+  class TaskRunner;
+
+  /**
+   * Completion handle for a batch of tasks enqueued into TaskRunner.
+   * Opens when every task of the batch is executed, dropped by clear()
+   * or rejected on enqueue.
+   */
+  class TaskLatch: private Uncopyable
+  {
+  public:
+    /**
+     * Constructor
+     * @param count number of tasks to wait for
+     */
+    explicit
+    TaskLatch(unsigned long count) noexcept;
+
+    /**
+     * Waits for the batch completion
+     * @param timeout absolute time or interval (see time_is_relative),
+     * NULL timeout means infinite wait
+     * @param time_is_relative timeout is an interval
+     * @return false if timeout is reached
+     */
+    bool
+    wait(const Time* timeout = 0, bool time_is_relative = false)
+      /*throw(Gears::Exception)*/;
+
+    /**
+     * @return true if all tasks of the batch are completed
+     */
+    bool
+    done() const noexcept;
+
+    /**
+     * @return number of not completed tasks
+     */
+    unsigned long
+    count() const noexcept;
+
+  private:
+    friend class TaskRunner;
+
+    void
+    count_down_(unsigned long count) noexcept;
+
+  private:
+    Condition cond_;
+    std::atomic<unsigned long> count_;
+    // keeps the latch alive while it is referenced by queued tasks
+    std::shared_ptr<TaskLatch> self_;
+  };
+
+  typedef std::shared_ptr<TaskLatch> TaskLatch_var;
+
+  /**
+   * Cancellation flag shared by the client and queued tasks.
+   * TaskRunner discards a queued task if its token is cancelled
+   * before the task execution starts.
+   */
+  class CancellationToken: private Uncopyable
+  {
+  public:
+    CancellationToken() noexcept;
+
+    void
+    cancel() noexcept;
+
+    bool
+    cancelled() const noexcept;
+
+  private:
+    std::atomic<bool> cancelled_;
+  };
+
+  typedef std::shared_ptr<CancellationToken> CancellationToken_var;
+
   /**
    * Performs tasks in several threads parallelly.
    */
@@ -41,6 +123,140 @@ namespace Gears
     DECLARE_EXCEPTION(Overflow, Exception);
     DECLARE_EXCEPTION(NotActive, Exception);
 
+    /**
+     * Task queue implementation
+     */
+    enum QueueType
+    {
+      // std::deque protected by mutex, unbounded if max_pending_tasks is 0
+      QT_LOCKED,
+      // bounded lock-free ring, capacity is max_pending_tasks or
+      // DEFAULT_LOCK_FREE_CAPACITY if max_pending_tasks is 0
+      QT_LOCK_FREE,
+      // deque per working thread: tasks enqueued from a working thread
+      // go to its own deque (LIFO), idle threads steal from the others
+      // (FIFO), tasks enqueued from other threads go to a shared deque
+      QT_WORK_STEALING
+    };
+
+    // Lock-free queue capacity for runners without max_pending_tasks
+    static const unsigned long DEFAULT_LOCK_FREE_CAPACITY = 64 * 1024;
+
+    // Awaiter of schedule(), defined in Coroutine.hpp
+    class ScheduleAwaiter;
+
+    typedef DurationHistogram Histogram;
+
+    /**
+     * Cumulative statistics of the runner since construction
+     */
+    struct Stats
+    {
+      Stats() noexcept;
+
+      // time from enqueue to execution start
+      Histogram queue_wait;
+      // time spent in task execution
+      Histogram execution;
+      // number of tasks rejected with Overflow
+      unsigned long overflows;
+      // number of enqueues that waited for room in the full queue
+      unsigned long enqueue_waits;
+      // number of tasks discarded because their deadline passed
+      unsigned long expired;
+      // number of tasks discarded because they were cancelled
+      unsigned long cancelled;
+      // maximum number of tasks waiting for a free thread
+      unsigned long max_queue_depth;
+    };
+
+    /**
+     * Lane of multi-lane TaskRunner
+     */
+    struct Lane
+    {
+      /**
+       * Constructor
+       * @param max_pending_tasks maximum length of the lane queue,
+       * 0 - unlimited
+       * @param weight share of the lane for LP_WEIGHTED policy
+       */
+      explicit
+      Lane(
+        unsigned long max_pending_tasks = 0,
+        unsigned long weight = 1)
+        noexcept;
+
+      unsigned long max_pending_tasks;
+      unsigned long weight;
+    };
+
+    typedef std::vector<Lane> LaneArray;
+
+    /**
+     * Order of serving lanes of multi-lane TaskRunner
+     */
+    enum LanePolicy
+    {
+      // a task is taken from a lane only if all lanes with less
+      // index are empty
+      LP_STRICT,
+      // non-empty lanes are served round robin, lane gives up to its
+      // weight tasks per round
+      LP_WEIGHTED
+    };
+
+    /**
+     * Thread count limits of elastic TaskRunner.
+     * The runner starts min_threads threads, adds a thread when
+     * grow_queue_depth tasks are waiting for a free thread or a task
+     * waited in the queue longer than grow_wait_time, and retires
+     * a thread that stays idle for idle_timeout until min_threads
+     * threads are left.
+     */
+    struct ElasticOptions
+    {
+      /**
+       * Constructor
+       * @param min_threads number of threads that are never retired
+       * @param max_threads maximum number of threads
+       * @param grow_queue_depth number of tasks without free thread
+       * that adds a thread
+       * @param grow_wait_time queue wait time of a task that adds
+       * a thread, ZERO - don't check the wait time
+       * @param idle_timeout time of thread inactivity before retirement
+       */
+      ElasticOptions(
+        unsigned int min_threads,
+        unsigned int max_threads,
+        unsigned long grow_queue_depth = 1,
+        const Time& grow_wait_time = Time::ZERO,
+        const Time& idle_timeout = Time::ONE_MINUTE)
+        noexcept;
+
+      unsigned int min_threads;
+      unsigned int max_threads;
+      unsigned long grow_queue_depth;
+      Time grow_wait_time;
+      Time idle_timeout;
+    };
+
+    /**
+     * Constructor
+     * @param callback not null callback is called on errors
+     * @param threads_number number of working threads
+     * @param thread_options options of threads: stack size, placement
+     * @param max_pending_tasks maximum task queue length
+     * @param queue_type task queue implementation
+     */
+    TaskRunner(
+      ActiveObjectCallback_var callback,
+      unsigned int threads_number,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options(),
+      unsigned long max_pending_tasks = 0,
+      QueueType queue_type = QT_LOCKED)
+      /*throw(InvalidArgument, Exception, Gears::Exception)*/;
+
     /**
      * Constructor
      * @param callback not null callback is called on errors
@@ -51,13 +267,77 @@ namespace Gears
     TaskRunner(
       ActiveObjectCallback_var callback,
       unsigned int threads_number,
-      size_t stack_size = 0,
+      size_t stack_size,
       unsigned long max_pending_tasks = 0)
       /*throw(InvalidArgument, Exception, Gears::Exception)*/;
 
+    /**
+     * Constructor of multi-lane runner. Working threads are shared by all
+     * lanes, lanes are indexed in the order of the array.
+     * Tasks enqueued without lane go to the lane 0.
+     * @param callback not null callback is called on errors
+     * @param threads_number number of working threads
+     * @param lanes not empty array of lanes
+     * @param lane_policy order of serving the lanes
+     * @param thread_options options of threads: stack size, placement
+     */
+    TaskRunner(
+      ActiveObjectCallback_var callback,
+      unsigned int threads_number,
+      const LaneArray& lanes,
+      LanePolicy lane_policy = LP_STRICT,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options())
+      /*throw(InvalidArgument, Exception, Gears::Exception)*/;
+
+    /**
+     * Constructor of elastic runner
+     * @param callback not null callback is called on errors
+     * @param elastic_options thread count limits
+     * @param thread_options options of threads: stack size, placement
+     * @param max_pending_tasks maximum task queue length
+     * @param queue_type task queue implementation
+     */
+    TaskRunner(
+      ActiveObjectCallback_var callback,
+      const ElasticOptions& elastic_options,
+      const ThreadRunner::Options& thread_options = ThreadRunner::Options(),
+      unsigned long max_pending_tasks = 0,
+      QueueType queue_type = QT_LOCKED)
+      /*throw(InvalidArgument, Exception, Gears::Exception)*/;
+
+    /**
+     * Constructor of runner without own threads: its tasks are executed
+     * by the threads of the shared executor while the runner is active.
+     * The executor serves attached runners and planners round robin,
+     * the runner executes up to weight tasks in a row while other
+     * sources have pending work. thread_count() is the number
+     * of executor threads.
+     * @param callback not null callback is called on errors
+     * @param executor not null executor to attach to
+     * @param weight share of the runner in the executor, not zero
+     * @param max_pending_tasks maximum task queue length
+     * @param queue_type task queue implementation, QT_WORK_STEALING
+     * isn't supported
+     */
+    TaskRunner(
+      ActiveObjectCallback_var callback,
+      SharedExecutor_var executor,
+      unsigned long weight = 1,
+      unsigned long max_pending_tasks = 0,
+      QueueType queue_type = QT_LOCKED)
+      /*throw(InvalidArgument, Exception, Gears::Exception)*/;
+
     virtual
     ~TaskRunner() noexcept;
 
+    /**
+     * Waits for deactivation completion, for runner attached to
+     * a shared executor waits for the tasks executing now
+     */
+    virtual
+    void
+    wait_object() /*throw(Exception, Gears::Exception)*/;
+
     /**
      * Enqueues a task
      * @param task task to enqueue. Number of references is not increased
@@ -70,6 +350,141 @@ namespace Gears
     enqueue_task(Task_var task, const Time* timeout = 0)
       /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
 
+    /**
+     * Enqueues a task held by value. Small functors are stored inside
+     * the queue element, so enqueuing and executing them does not
+     * allocate memory.
+     * @param task not empty task to enqueue
+     * @param timeout see above
+     */
+    void
+    enqueue_task(InlineTask task, const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Enqueues a task that is discarded without execution if its deadline
+     * passes or it is cancelled before a working thread takes it.
+     * Discarded tasks are counted in stats().
+     * @param task task to enqueue
+     * @param deadline absolute time, Time::ZERO - no deadline
+     * @param cancellation token, NULL - the task can't be cancelled
+     * @param timeout see above
+     */
+    void
+    enqueue_task(
+      Task_var task,
+      const Time& deadline,
+      CancellationToken_var cancellation = CancellationToken_var(),
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    void
+    enqueue_task(
+      InlineTask task,
+      const Time& deadline,
+      CancellationToken_var cancellation = CancellationToken_var(),
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Enqueues a task into the lane of multi-lane runner
+     * (lane is ignored by other runners)
+     * @param lane index of the lane, Overflow is thrown if the lane
+     * is full
+     * @param task task to enqueue
+     * @param timeout see above
+     */
+    void
+    enqueue_lane_task(
+      unsigned long lane,
+      Task_var task,
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    void
+    enqueue_lane_task(
+      unsigned long lane,
+      InlineTask task,
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Enqueues tasks of [begin, end) as a single batch: the queue is
+     * locked once, room for all tasks is reserved at once and only as
+     * many working threads as there are tasks are woken up.
+     * Either all tasks are enqueued or none of them, except QT_LOCK_FREE
+     * runner without max_pending_tasks: it enqueues the head of the batch
+     * that fits into the ring before throwing Overflow.
+     * @param begin beginning of the sequence of Task_var or InlineTask
+     * (or functors it can be constructed from)
+     * @param end end of the sequence
+     * @param timeout see enqueue_task
+     */
+    template <typename InputIterator>
+    void
+    enqueue_tasks(
+      InputIterator begin,
+      InputIterator end,
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Enqueues batch into the lane of multi-lane runner
+     */
+    template <typename InputIterator>
+    void
+    enqueue_lane_tasks(
+      unsigned long lane,
+      InputIterator begin,
+      InputIterator end,
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Enqueues tasks of [begin, end) as enqueue_tasks() does and returns
+     * the completion handle of the batch.
+     * @param begin beginning of the sequence
+     * @param end end of the sequence
+     * @param timeout see enqueue_task
+     * @return latch opened when all tasks of the batch are completed
+     */
+    template <typename InputIterator>
+    TaskLatch_var
+    enqueue_tracked_tasks(
+      InputIterator begin,
+      InputIterator end,
+      const Time* timeout = 0)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Enqueues goals that are tasks (TaskGoal, GoalTask) as a single
+     * batch without calling their deliver(), if the batch doesn't fit into the queue enqueues tasks
+     * one by one while there is room. Goals that aren't tasks are
+     * delivered by deliver(). Used by Planner for batched delivery
+     * of due goals. The first error is rethrown after all goals
+     * are handled.
+     * @param goals goals to enqueue
+     */
+    void
+    enqueue_goals(const GoalArray& goals)
+      /*throw(Overflow, NotActive, Gears::Exception)*/;
+
+    /**
+     * Awaitable moving the coroutine into a working thread:
+     * co_await runner->schedule() (requires Coroutine.hpp).
+     * Overflow and NotActive are thrown from co_await.
+     */
+    ScheduleAwaiter
+    schedule() noexcept;
+
+    /**
+     * Snapshot of statistics. Working threads record it into own
+     * buckets, snapshot sums them up.
+     * @return statistics since construction
+     */
+    Stats
+    stats() noexcept;
+
     /**
      * Returns number of tasks recently being enqueued
      * This number does not have much meaning in MT environment
@@ -78,6 +493,22 @@ namespace Gears
     unsigned long
     task_count() noexcept;
 
+    /**
+     * Returns number of tasks enqueued but not finished yet
+     * (queued and executing ones)
+     * @return number of unfinished tasks
+     */
+    unsigned long
+    unfinished_task_count() noexcept;
+
+    /**
+     * Returns number of working threads, it changes in time
+     * for elastic runner
+     * @return number of working threads
+     */
+    unsigned long
+    thread_count() noexcept;
+
     /**
      * Waits for the moment task queue is empty and returns control.
      * In MT environment tasks can be added at the very same moment of
@@ -86,6 +517,19 @@ namespace Gears
     void
     wait_for_queue_exhausting() /*throw(Gears::Exception)*/;
 
+    /**
+     * Waits for the moment task queue is empty and no task is executing.
+     * Returns as soon as the last task is finished.
+     * Must not be called from the runner's tasks.
+     * @param timeout absolute time or interval (see time_is_relative),
+     * NULL timeout means infinite wait
+     * @param time_is_relative timeout is an interval
+     * @return false if timeout is reached
+     */
+    bool
+    wait_idle(const Time* timeout = 0, bool time_is_relative = false)
+      /*throw(Gears::Exception)*/;
+
     /**
      * Clear task queue
      */
@@ -93,14 +537,167 @@ namespace Gears
     clear() /*throw(Gears::Exception)*/;
 
   private:
-    class TaskRunnerJob: public SingleJob
+    /**
+     * Element of task queue
+     */
+    struct QueuedTask
+    {
+      QueuedTask() noexcept;
+
+      explicit
+      QueuedTask(
+        InlineTask task_val,
+        unsigned long lane_val = 0,
+        TaskLatch* latch_val = 0)
+        noexcept;
+
+      InlineTask task;
+      unsigned long lane;
+      TaskLatch* latch;
+      Time enqueue_time;
+      // ZERO - no deadline
+      Time deadline;
+      CancellationToken_var cancellation;
+    };
+
+    typedef std::deque<QueuedTask> QueuedTaskList;
+
+    /**
+     * Storage of pending tasks. Wakeups and overflow control
+     * are done by TaskRunnerJob, queue only keeps the tasks.
+     */
+    class TaskQueue
     {
     public:
+      virtual
+      ~TaskQueue() noexcept = default;
+
+      /**
+       * Moves tasks into the queue in their order
+       * @param tasks tasks to move into the queue
+       * @param count number of tasks
+       * @return number of moved tasks, less than count if there is no room
+       * for the rest of them
+       */
+      virtual unsigned long
+      push(QueuedTask* tasks, unsigned long count)
+        /*throw(Gears::Exception)*/ = 0;
+
+      /**
+       * @param task receiver of the task
+       * @return false if the queue is empty
+       */
+      virtual bool
+      pop(QueuedTask& task) noexcept = 0;
+
+      virtual unsigned long
+      size() noexcept = 0;
+
+      /**
+       * Moves all tasks out of the queue
+       * @param tasks receiver of the dropped tasks
+       * @return number of dropped tasks
+       */
+      virtual unsigned long
+      clear(QueuedTaskList& tasks) /*throw(Gears::Exception)*/ = 0;
+
+      /**
+       * Called in working thread before it starts to pop tasks
+       */
+      virtual void
+      worker_started() noexcept;
+
+      /**
+       * Called in working thread after it stopped to pop tasks
+       */
+      virtual void
+      worker_stopped() noexcept;
+    };
+
+    typedef std::unique_ptr<TaskQueue> TaskQueue_var;
+
+    /**
+     * Adapter of Task_var to InlineTask
+     */
+    struct TaskCall
+    {
+      void
+      operator()() /*throw(Gears::Exception)*/
+      {
+        task->execute();
+      }
+
+      Task_var task;
+    };
+
+    static
+    InlineTask
+    make_task_(Task_var task) /*throw(Gears::Exception)*/;
+
+    static
+    InlineTask
+    make_task_(InlineTask task) noexcept;
+
+    static
+    TaskQueue_var
+    create_queue_(
+      QueueType queue_type,
+      unsigned long number_of_threads,
+      unsigned long max_pending_tasks)
+      /*throw(Gears::Exception)*/;
+
+    /**
+     * Checks arguments of runner attached to a shared executor
+     * @return thread limits equal to the number of executor threads
+     */
+    static
+    ElasticOptions
+    executor_options_(
+      const SharedExecutor_var& executor,
+      unsigned long weight,
+      QueueType queue_type)
+      /*throw(InvalidArgument)*/;
+
+    static
+    TaskQueue_var
+    create_lane_queue_(
+      const LaneArray& lanes,
+      LanePolicy lane_policy)
+      /*throw(InvalidArgument, Gears::Exception)*/;
+
+    template <typename InputIterator>
+    void
+    enqueue_tasks_(
+      unsigned long lane,
+      InputIterator begin,
+      InputIterator end,
+      const Time* timeout)
+      /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+    class LockedTaskQueue;
+    class LockFreeTaskQueue;
+    class WorkStealingTaskQueue;
+    class LaneTaskQueue;
+
+    class TaskRunnerJob:
+      public SingleJob,
+      public SharedExecutor::Source
+    {
+    public:
+      /**
+       * Constructor
+       * @param executor shared executor that executes tasks instead
+       * of own threads, NULL - tasks are executed by own threads
+       * @param weight share of the runner in the executor
+       */
       TaskRunnerJob(
         ActiveObjectCallback_var callback,
-        unsigned long number_of_threads,
-        unsigned long max_pending_tasks)
-        /*throw(Gears::Exception)*/;
+        const ElasticOptions& elastic_options,
+        unsigned long max_pending_tasks,
+        TaskQueue_var tasks,
+        SharedExecutor_var executor = SharedExecutor_var(),
+        unsigned long weight = 1)
+        /*throw(InvalidArgument, Gears::Exception)*/;
 
       virtual
       ~TaskRunnerJob() noexcept;
@@ -108,32 +705,170 @@ namespace Gears
       virtual void
       work() noexcept;
 
+      virtual void
+      started(unsigned threads) noexcept;
+
       virtual void
       terminate() noexcept;
 
+      /**
+       * Executes one task in a shared executor thread
+       */
+      virtual void
+      execute_unit() noexcept;
+
+      /**
+       * Waits for the tasks executed by the shared executor
+       * after deactivation
+       */
+      void
+      wait_detached() /*throw(Gears::Exception)*/;
+
+      /**
+       * Sets runner used for adding threads to elastic runner
+       */
       void
-      enqueue_task(Task_var task, const Time* timeout)
+      thread_runner(ThreadRunner& thread_runner) noexcept;
+
+      void
+      enqueue_task(
+        InlineTask task,
+        unsigned long lane,
+        const Time* timeout)
+        /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+      void
+      enqueue_task(
+        QueuedTask& task,
+        const Time* timeout)
+        /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
+
+      void
+      enqueue_tasks(
+        QueuedTask* tasks,
+        unsigned long count,
+        const Time* timeout)
         /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/;
 
       unsigned long
       task_count() noexcept;
 
+      unsigned long
+      unfinished_task_count() noexcept;
+
+      unsigned long
+      thread_count() noexcept;
+
+      Stats
+      stats() noexcept;
+
       void
       wait_for_queue_exhausting() /*throw(Gears::Exception)*/;
 
+      bool
+      wait_idle(const Time* timeout, bool time_is_relative)
+        /*throw(Gears::Exception)*/;
+
       void
       clear() /*throw(Gears::Exception)*/;
 
     private:
-      typedef Gears::Mutex SyncPolicy;
-      typedef std::deque<Task_var> Tasks;
+      struct WorkerStats;
+
+      typedef std::unique_ptr<WorkerStats[]> WorkerStatsArray;
+
+      /**
+       * Takes statistics buckets of the working thread
+       * @return buckets or NULL if all of them are in use
+       */
+      WorkerStats*
+      acquire_worker_stats_() noexcept;
+
+      /**
+       * Accounts tasks rejected with Overflow
+       */
+      void
+      overflow_(unsigned long count) noexcept;
+
+      /**
+       * Reserves room for tasks in the limited queue, waits for it
+       * up to timeout
+       * @return false if there is no room
+       */
+      bool
+      reserve_(unsigned long count, const Time* timeout)
+        /*throw(Gears::Exception)*/;
+
+      /**
+       * Checks deadline and cancellation of the task taken from the queue
+       * @return true if the task should be discarded, it is accounted
+       */
+      bool
+      discard_(const QueuedTask& task, const Time& now) noexcept;
+
+      /**
+       * Executes the task taken from the queue and accounts it
+       * @param stats buckets of the thread, can be NULL
+       */
+      void
+      execute_task_(QueuedTask& task, WorkerStats* stats) noexcept;
+
+      /**
+       * Accounts tasks that will not be executed
+       */
+      void
+      drop_tasks_(QueuedTask* tasks, unsigned long count) noexcept;
+
+      /**
+       * Accounts finished (or dropped) tasks, wakes wait_idle() callers
+       */
+      void
+      tasks_finished_(unsigned long count) noexcept;
+
+      /**
+       * Waits for a task wakeup, retires the thread of elastic runner
+       * if it was idle for idle timeout
+       * @return false if the thread should exit
+       */
+      bool
+      wait_task_() /*throw(Gears::Exception)*/;
+
+      /**
+       * Adds a thread to elastic runner if the limit allows it
+       */
+      void
+      grow_() noexcept;
 
     private:
       const unsigned long NUMBER_OF_THREADS_;
-      Tasks tasks_;
-      Semaphore new_task_;
-      Semaphore not_full_;
+      const unsigned long MIN_THREADS_;
+      const bool ELASTIC_;
+      const unsigned long GROW_QUEUE_DEPTH_;
+      const Time GROW_WAIT_TIME_;
+      const Time IDLE_TIMEOUT_;
+      TaskQueue_var tasks_;
+      AtomicSemaphore new_task_;
+      AtomicSemaphore not_full_;
       const bool LIMITED_;
+
+      // tasks enqueued and not finished yet
+      std::atomic<unsigned long> unfinished_tasks_;
+      Condition idle_;
+
+      // statistics
+      WorkerStatsArray worker_stats_;
+      std::atomic<unsigned long> overflows_;
+      std::atomic<unsigned long> enqueue_waits_;
+      std::atomic<unsigned long> expired_;
+      std::atomic<unsigned long> cancelled_;
+      std::atomic<unsigned long> max_queue_depth_;
+
+      // elastic runner state, changed under mutex()
+      ThreadRunner* thread_runner_;
+      std::atomic<unsigned long> thread_count_;
+      std::atomic<bool> growing_;
+
+      SharedExecutor_var executor_;
     };
 
     typedef std::shared_ptr<TaskRunnerJob>
@@ -170,8 +905,12 @@ namespace Gears
     /**
      * Constructor
      * @param task_runner TaskRunner to put the object into.
+     * @param batch goals of the same TaskRunner due together are put
+     * into it by one enqueue without deliver() calls, don't set it if
+     * deliver() is overridden
      */
-    TaskGoal(TaskRunner_var task_runner) /*throw(Gears::Exception)*/;
+    TaskGoal(TaskRunner_var task_runner, bool batch = false)
+      /*throw(Gears::Exception)*/;
 
     /**
      * Destructor
@@ -186,8 +925,23 @@ namespace Gears
     virtual void
     deliver() /*throw(Gears::Exception)*/;
 
+    /**
+     * Goals put into the same TaskRunner are delivered as a batch
+     * if batching is enabled
+     * @return the TaskRunner if batching is enabled, NULL otherwise
+     */
+    virtual const void*
+    batch_key() const noexcept;
+
+    /**
+     * Puts the goals into the TaskRunner by one enqueue
+     */
+    virtual void
+    deliver_batch(const GoalArray& goals) /*throw(Gears::Exception)*/;
+
   private:
     TaskRunner_var task_runner_;
+    const bool BATCH_;
   };
 
   /**
@@ -206,8 +960,13 @@ namespace Gears
      * @param planner Planner to put the object into.
      * @param task_runner TaskRunner to put the object into.
      * or in Planner otherwisee
+     * @param batch see TaskGoal::TaskGoal()
      */
-    GoalTask(Planner_var planner, TaskRunner_var task_runner) /*throw(Gears::Exception)*/;
+    GoalTask(
+      Planner_var planner,
+      TaskRunner_var task_runner,
+      bool batch = false)
+      /*throw(Gears::Exception)*/;
 
     /**
      * Implementation of Goal::deliver.
@@ -216,6 +975,20 @@ namespace Gears
     virtual void
     deliver() /*throw(Gears::Exception)*/;
 
+    /**
+     * Goals put into the same TaskRunner are delivered as a batch
+     * if batching is enabled
+     * @return the TaskRunner if batching is enabled, NULL otherwise
+     */
+    virtual const void*
+    batch_key() const noexcept;
+
+    /**
+     * Puts the goals into the TaskRunner by one enqueue
+     */
+    virtual void
+    deliver_batch(const GoalArray& goals) /*throw(Gears::Exception)*/;
+
     /**
      * Put the object into the Planner. Call this in execute().
      * @param when time of putting the object into the TaskRunner
@@ -233,6 +1006,7 @@ namespace Gears
   private:
     Planner_var planner_;
     TaskRunner_var task_runner_;
+    const bool BATCH_;
   };
 }
 
@@ -250,14 +1024,128 @@ namespace Gears
   Task::~Task() noexcept
   {}
 
+  //
+  // TaskLatch class
+  //
+
+  inline
+  TaskLatch::TaskLatch(unsigned long count) noexcept
+    : count_(count)
+  {}
+
+  inline
+  bool
+  TaskLatch::done() const noexcept
+  {
+    return count_.load(std::memory_order_acquire) == 0;
+  }
+
+  inline
+  unsigned long
+  TaskLatch::count() const noexcept
+  {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  //
+  // CancellationToken class
+  //
+
+  inline
+  CancellationToken::CancellationToken() noexcept
+    : cancelled_(false)
+  {}
+
+  inline
+  void
+  CancellationToken::cancel() noexcept
+  {
+    cancelled_.store(true, std::memory_order_relaxed);
+  }
+
+  inline
+  bool
+  CancellationToken::cancelled() const noexcept
+  {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+  //
+  // TaskRunner::Lane class
+  //
+
+  inline
+  TaskRunner::Lane::Lane(
+    unsigned long max_pending_tasks_val,
+    unsigned long weight_val)
+    noexcept
+    : max_pending_tasks(max_pending_tasks_val),
+      weight(weight_val)
+  {}
+
+  //
+  // TaskRunner::ElasticOptions class
+  //
+
+  inline
+  TaskRunner::ElasticOptions::ElasticOptions(
+    unsigned int min_threads_val,
+    unsigned int max_threads_val,
+    unsigned long grow_queue_depth_val,
+    const Time& grow_wait_time_val,
+    const Time& idle_timeout_val)
+    noexcept
+    : min_threads(min_threads_val),
+      max_threads(max_threads_val),
+      grow_queue_depth(grow_queue_depth_val),
+      grow_wait_time(grow_wait_time_val),
+      idle_timeout(idle_timeout_val)
+  {}
+
+  //
+  // TaskRunner::QueuedTask class
+  //
+
+  inline
+  TaskRunner::QueuedTask::QueuedTask() noexcept
+    : lane(0),
+      latch(0)
+  {}
+
+  inline
+  TaskRunner::QueuedTask::QueuedTask(
+    InlineTask task_val,
+    unsigned long lane_val,
+    TaskLatch* latch_val)
+    noexcept
+    : task(std::move(task_val)),
+      lane(lane_val),
+      latch(latch_val)
+  {}
+
+  //
+  // TaskRunner::TaskQueue class
+  //
+
+  inline
+  void
+  TaskRunner::TaskQueue::worker_started() noexcept
+  {}
+
+  inline
+  void
+  TaskRunner::TaskQueue::worker_stopped() noexcept
+  {}
+
   //
   // TaskGoal class
   //
 
   inline
-  TaskGoal::TaskGoal(TaskRunner_var task_runner)
+  TaskGoal::TaskGoal(TaskRunner_var task_runner, bool batch)
     /*throw(Gears::Exception)*/
-    : task_runner_(std::move(task_runner))
+    : task_runner_(std::move(task_runner)),
+      BATCH_(batch)
   {}
 
   inline
@@ -270,15 +1158,33 @@ namespace Gears
     task_runner_->enqueue_task(shared_from_this());
   }
 
+  inline
+  const void*
+  TaskGoal::batch_key() const noexcept
+  {
+    return BATCH_ ? task_runner_.get() : 0;
+  }
+
+  inline
+  void
+  TaskGoal::deliver_batch(const GoalArray& goals) /*throw(Gears::Exception)*/
+  {
+    task_runner_->enqueue_goals(goals);
+  }
+
   //
   // GoalTask class
   //
 
   inline
-  GoalTask::GoalTask(Planner_var planner, TaskRunner_var task_runner)
+  GoalTask::GoalTask(
+    Planner_var planner,
+    TaskRunner_var task_runner,
+    bool batch)
     /*throw(Gears::Exception)*/
     : planner_(std::move(planner)),
-      task_runner_(std::move(task_runner))
+      task_runner_(std::move(task_runner)),
+      BATCH_(batch)
   {}
 
   inline
@@ -292,6 +1198,20 @@ namespace Gears
     task_runner_->enqueue_task(shared_from_this());
   }
 
+  inline
+  const void*
+  GoalTask::batch_key() const noexcept
+  {
+    return BATCH_ ? task_runner_.get() : 0;
+  }
+
+  inline
+  void
+  GoalTask::deliver_batch(const GoalArray& goals) /*throw(Gears::Exception)*/
+  {
+    task_runner_->enqueue_goals(goals);
+  }
+
   inline
   void
   GoalTask::schedule(const Time& when) /*throw(Gears::Exception)*/
@@ -307,20 +1227,188 @@ namespace Gears
   unsigned long
   TaskRunner::TaskRunnerJob::task_count() noexcept
   {
-    SyncPolicy::ReadGuard guard(mutex());
-    return tasks_.size();
+    return tasks_->size();
+  }
+
+  inline
+  unsigned long
+  TaskRunner::TaskRunnerJob::unfinished_task_count() noexcept
+  {
+    return unfinished_tasks_.load(std::memory_order_relaxed);
+  }
+
+  inline
+  unsigned long
+  TaskRunner::TaskRunnerJob::thread_count() noexcept
+  {
+    return thread_count_.load(std::memory_order_relaxed);
+  }
+
+  inline
+  void
+  TaskRunner::TaskRunnerJob::thread_runner(ThreadRunner& thread_runner)
+    noexcept
+  {
+    thread_runner_ = &thread_runner;
   }
 
   //
   // TaskRunner class
   //
 
+  inline
+  InlineTask
+  TaskRunner::make_task_(Task_var task) /*throw(Gears::Exception)*/
+  {
+    return task ? InlineTask(TaskCall{std::move(task)}) : InlineTask();
+  }
+
+  inline
+  InlineTask
+  TaskRunner::make_task_(InlineTask task) noexcept
+  {
+    return task;
+  }
+
   inline
   void
   TaskRunner::enqueue_task(Task_var task, const Time* timeout)
     /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
   {
-    job_.enqueue_task(task, timeout);
+    job_.enqueue_task(make_task_(std::move(task)), 0, timeout);
+  }
+
+  inline
+  void
+  TaskRunner::enqueue_task(InlineTask task, const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    job_.enqueue_task(std::move(task), 0, timeout);
+  }
+
+  inline
+  void
+  TaskRunner::enqueue_task(
+    Task_var task,
+    const Time& deadline,
+    CancellationToken_var cancellation,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    enqueue_task(
+      make_task_(std::move(task)),
+      deadline,
+      std::move(cancellation),
+      timeout);
+  }
+
+  inline
+  void
+  TaskRunner::enqueue_task(
+    InlineTask task,
+    const Time& deadline,
+    CancellationToken_var cancellation,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    QueuedTask queued_task(std::move(task));
+    queued_task.deadline = deadline;
+    queued_task.cancellation = std::move(cancellation);
+    job_.enqueue_task(queued_task, timeout);
+  }
+
+  inline
+  void
+  TaskRunner::enqueue_lane_task(
+    unsigned long lane,
+    Task_var task,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    job_.enqueue_task(make_task_(std::move(task)), lane, timeout);
+  }
+
+  inline
+  void
+  TaskRunner::enqueue_lane_task(
+    unsigned long lane,
+    InlineTask task,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    job_.enqueue_task(std::move(task), lane, timeout);
+  }
+
+  template <typename InputIterator>
+  void
+  TaskRunner::enqueue_tasks_(
+    unsigned long lane,
+    InputIterator begin,
+    InputIterator end,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    std::vector<QueuedTask> tasks;
+    for(; begin != end; ++begin)
+    {
+      tasks.emplace_back(make_task_(*begin), lane);
+    }
+    job_.enqueue_tasks(tasks.data(), tasks.size(), timeout);
+  }
+
+  template <typename InputIterator>
+  void
+  TaskRunner::enqueue_tasks(
+    InputIterator begin,
+    InputIterator end,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    enqueue_tasks_(0, begin, end, timeout);
+  }
+
+  template <typename InputIterator>
+  void
+  TaskRunner::enqueue_lane_tasks(
+    unsigned long lane,
+    InputIterator begin,
+    InputIterator end,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    enqueue_tasks_(lane, begin, end, timeout);
+  }
+
+  template <typename InputIterator>
+  TaskLatch_var
+  TaskRunner::enqueue_tracked_tasks(
+    InputIterator begin,
+    InputIterator end,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    std::vector<QueuedTask> tasks;
+    for(; begin != end; ++begin)
+    {
+      tasks.emplace_back(make_task_(*begin));
+    }
+
+    TaskLatch_var latch(new TaskLatch(tasks.size()));
+
+    if(!tasks.empty())
+    {
+      latch->self_ = latch;
+
+      for(auto it = tasks.begin(); it != tasks.end(); ++it)
+      {
+        it->latch = latch.get();
+      }
+
+      // rejected tasks are counted down by the job
+      job_.enqueue_tasks(tasks.data(), tasks.size(), timeout);
+    }
+
+    return latch;
   }
 
   inline
@@ -330,6 +1418,35 @@ namespace Gears
     return job_.task_count();
   }
 
+  inline
+  unsigned long
+  TaskRunner::unfinished_task_count() noexcept
+  {
+    return job_.unfinished_task_count();
+  }
+
+  inline
+  unsigned long
+  TaskRunner::thread_count() noexcept
+  {
+    return job_.thread_count();
+  }
+
+  inline
+  TaskRunner::Stats
+  TaskRunner::stats() noexcept
+  {
+    return job_.stats();
+  }
+
+  inline
+  bool
+  TaskRunner::wait_idle(const Time* timeout, bool time_is_relative)
+    /*throw(Gears::Exception)*/
+  {
+    return job_.wait_idle(timeout, time_is_relative);
+  }
+
   inline
   void
   TaskRunner::wait_for_queue_exhausting() /*throw(Gears::Exception)*/
@@ -4,8 +4,10 @@
 #include <signal.h>
 #include <pthread.h>
 
+#include <atomic>
 #include <memory>
 #include <algorithm>
+#include <string>
 #include <vector>
 
 #include "Semaphore.hpp"
@@ -57,6 +59,16 @@ namespace Gears
     void
     on_stop() noexcept;
 
+    /**
+     * Called in the new thread if its placement (name, CPU affinity,
+     * NUMA binding) can't be applied, the job runs anyway.
+     * By default does nothing.
+     * @param description description of the failure
+     */
+    virtual
+    void
+    on_placement_error(const Gears::SubString& description) noexcept;
+
   protected:
     virtual
     ~ThreadCallback() noexcept = default;
@@ -73,9 +85,15 @@ namespace Gears
     DECLARE_EXCEPTION(Exception, Gears::DescriptiveException);
     DECLARE_EXCEPTION(AlreadyStarted, Exception);
     DECLARE_EXCEPTION(PosixException, Exception);
+    DECLARE_EXCEPTION(InvalidArgument, Exception);
+
+    // CPU indexes
+    typedef std::vector<unsigned> CpuList;
 
     /**
      * Options for threads.
+     * Placement (CPU affinity, NUMA binding) and name are applied in
+     * the thread before the job starts.
      */
     struct Options
     {
@@ -95,6 +113,22 @@ namespace Gears
 
       size_t stack_size;
       ThreadCallback_var thread_callback;
+
+      // CPU masks, thread i may run on cpu_affinity[i % size()],
+      // empty - no restriction
+      std::vector<CpuList> cpu_affinity;
+
+      // pin each thread to a single CPU of its mask (or NUMA node, or
+      // process affinity), consecutive threads take consecutive CPUs
+      bool pin_round_robin;
+
+      // NUMA node to run the threads on and allocate their memory from,
+      // -1 - no binding
+      int numa_node;
+
+      // thread name prefix, threads are named <thread_name>-<index>
+      // (truncated to 15 characters), empty - don't name
+      std::string thread_name;
     };
 
     /**
@@ -170,6 +204,17 @@ namespace Gears
     void
     start_one() /*throw (AlreadyStarted, PosixException)*/;
 
+    /**
+     * Runs a job again in a new thread: the thread of a job that
+     * already returned is joined and its slot is reused, otherwise
+     * a thread is created for a not started job. A job which thread
+     * creation failed is retried by the next call. Thread unsafe.
+     * Must be called only when the runner is started.
+     * @return false if all jobs are still running
+     */
+    bool
+    restart_one() /*throw (PosixException)*/;
+
     /**
      * Waits for termination of previously started threads.
      * Thread unsafe.
@@ -182,8 +227,17 @@ namespace Gears
     void*
     thread_func_(void* arg) noexcept;
 
+    struct JobInfo;
+
+    void
+    thread_func_(JobInfo& info) noexcept;
+
+    void
+    apply_placement_(const JobInfo& info) noexcept;
+
     void
-    thread_func_(ThreadJob& job) noexcept;
+    init_placement_(const Options& options)
+      /*throw (InvalidArgument, Gears::Exception)*/;
 
     void
     start_one_thread_() /*throw (PosixException)*/;
@@ -205,11 +259,15 @@ namespace Gears
     struct JobInfo
     {
       JobInfo()
+        : finished(false),
+          no_thread(false)
       {}
 
       JobInfo(ThreadRunner* runner_val, ThreadJob_var job_val)
         : runner(runner_val),
-          job(job_val)
+          job(job_val),
+          finished(false),
+          no_thread(false)
       {
         assert(job);
       }
@@ -217,11 +275,26 @@ namespace Gears
       ThreadRunner* runner;
       ThreadJob_var job;
       pthread_t thread_id;
+      // job returned, thread can be joined without blocking
+      std::atomic<bool> finished;
+      // restart of the job failed, there is no thread to join
+      bool no_thread;
+
+      // placement, empty cpus - don't set affinity
+      CpuList cpus;
+      std::string name;
     };
 
+    void
+    create_thread_(JobInfo& info, const char* fun)
+      /*throw (PosixException)*/;
+
+  private:
     PThreadAttr attr_;
     ThreadCallback_var thread_callback_;
 
+    int numa_node_;
+
     // required for implement grouped start logic (see start method description)
     Gears::Semaphore start_semaphore_;
     volatile sig_atomic_t number_running_;
@@ -259,6 +332,7 @@ namespace Gears
     /*throw (Gears::Exception, PosixException)*/
     : attr_(options.stack_size),
       thread_callback_(options.thread_callback),
+      numa_node_(options.numa_node),
       start_semaphore_(0),
       number_running_(0),
       number_of_jobs_(number_of_jobs)
@@ -269,6 +343,8 @@ namespace Gears
     {
       jobs_.emplace_back(new JobInfo(this, functor()));
     }
+
+    init_placement_(options);
   }
 
   template <typename ForwardIterator>
@@ -279,6 +355,7 @@ namespace Gears
     /*throw (Gears::Exception, PosixException)*/
     : attr_(options.stack_size),
       thread_callback_(options.thread_callback),
+      numa_node_(options.numa_node),
       start_semaphore_(0),
       number_running_(0),
       number_of_jobs_(std::distance(begin, end))
@@ -289,6 +366,8 @@ namespace Gears
     {
       jobs_.emplace_back(new JobInfo(this, *begin++));
     }
+
+    init_placement_(options);
   }
 }
 
@@ -112,14 +112,14 @@ namespace Gears
   ActiveObjectCommonImpl::ActiveObjectCommonImpl(
     const SingleJob_var& job,
     unsigned threads_number,
-    size_t stack_size,
+    const ThreadRunner::Options& thread_options,
     unsigned start_threads)
     /*throw (InvalidArgument)*/
     : SINGLE_JOB_(job),
       thread_runner_(
         job,
         threads_number,
-        ThreadRunner::Options(stack_size, job->callback())),
+        thread_options_(thread_options, job)),
       start_threads_(start_threads),
       work_mutex_(job->mutex()),
       active_state_(AS_NOT_ACTIVE)
@@ -134,6 +134,33 @@ namespace Gears
     }
   }
 
+  ActiveObjectCommonImpl::ActiveObjectCommonImpl(
+    const SingleJob_var& job,
+    unsigned threads_number,
+    size_t stack_size,
+    unsigned start_threads)
+    /*throw (InvalidArgument)*/
+    : ActiveObjectCommonImpl(
+        job,
+        threads_number,
+        ThreadRunner::Options(stack_size),
+        start_threads)
+  {}
+
+  ActiveObjectCommonImpl::ActiveObjectCommonImpl(
+    const SingleJob_var& job,
+    ExternalThreads)
+    /*throw (Gears::Exception)*/
+    : SINGLE_JOB_(job),
+      thread_runner_(
+        job,
+        0,
+        thread_options_(ThreadRunner::Options(), job)),
+      start_threads_(0),
+      work_mutex_(job->mutex()),
+      active_state_(AS_NOT_ACTIVE)
+  {}
+
   ActiveObjectCommonImpl::~ActiveObjectCommonImpl() noexcept
   {
     static const char* FUN = "ActiveObjectCommonImpl::~ActiveObjectCommonImpl()";
@@ -201,6 +228,20 @@ namespace Gears
     }
   }
 
+  ThreadRunner::Options
+  ActiveObjectCommonImpl::thread_options_(
+    const ThreadRunner::Options& thread_options,
+    const SingleJob_var& job)
+    /*throw (Gears::Exception)*/
+  {
+    ThreadRunner::Options options(thread_options);
+    if (!options.thread_callback)
+    {
+      options.thread_callback = job->callback();
+    }
+    return options;
+  }
+
   void
   ActiveObjectCommonImpl::activate_object()
     /*throw (AlreadyActive, Exception, Gears::Exception)*/
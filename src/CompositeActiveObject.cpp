@@ -1,5 +1,62 @@
+#include <algorithm>
+
+#include <gears/ActiveObjectCallback.hpp>
+#include <gears/TaskRunner.hpp>
+#include <gears/TaskGraph.hpp>
 #include <gears/CompositeActiveObject.hpp>
 
 namespace Gears
 {
+  namespace CompositeActiveObjectHelper
+  {
+    void
+    run_ordered(
+      unsigned long count,
+      const OrderArray& order,
+      unsigned long threads,
+      const std::function<void (unsigned long)>& operation)
+      /*throw (Gears::Exception)*/
+    {
+      if (!count)
+      {
+        return;
+      }
+
+      TaskGraph graph;
+
+      for (unsigned long i = 0; i < count; ++i)
+      {
+        graph.add_task(InlineTask([&operation, i]() { operation(i); }));
+      }
+
+      for (auto it = order.begin(); it != order.end(); ++it)
+      {
+        graph.add_dependency(it->second, it->first);
+      }
+
+      // operations don't throw, the callback reports runner failures only
+      TaskRunner runner(
+        ActiveObjectCallback_var(
+          new ActiveObjectCallbackImpl(Logger_var(), "CompositeActiveObject")),
+        static_cast<unsigned int>(std::min(threads, count)));
+
+      runner.activate_object();
+
+      try
+      {
+        graph.submit(&runner);
+        graph.wait();
+      }
+      catch (...)
+      {
+        graph.wait();
+        runner.deactivate_object();
+        runner.wait_object();
+        throw;
+      }
+
+      runner.deactivate_object();
+      runner.wait_object();
+    }
+  }
 }
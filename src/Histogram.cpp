@@ -0,0 +1,49 @@
+#include <cmath>
+
+#include <gears/Histogram.hpp>
+
+namespace Gears
+{
+  //
+  // DurationHistogram class
+  //
+
+  const unsigned long DurationHistogram::BUCKETS;
+
+  DurationHistogram::DurationHistogram() noexcept
+    : count(0)
+  {
+    std::fill(buckets, buckets + BUCKETS, 0);
+  }
+
+  Time
+  DurationHistogram::bucket_upper_bound(unsigned long bucket) noexcept
+  {
+    const unsigned long long usec = 1ull << std::min(bucket, BUCKETS - 1);
+    return Time(usec / Time::USEC_MAX, usec % Time::USEC_MAX);
+  }
+
+  Time
+  DurationHistogram::percentile(double fraction) const noexcept
+  {
+    if(!count)
+    {
+      return Time::ZERO;
+    }
+
+    const unsigned long target = std::max<unsigned long>(
+      static_cast<unsigned long>(std::ceil(fraction * count)), 1);
+    unsigned long sum = 0;
+
+    for(unsigned long i = 0; i < BUCKETS - 1; ++i)
+    {
+      sum += buckets[i];
+      if(sum >= target)
+      {
+        return std::min(bucket_upper_bound(i), max);
+      }
+    }
+
+    return max;
+  }
+}
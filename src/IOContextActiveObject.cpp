@@ -1,6 +1,8 @@
 #include <deque>
 #include <thread>
+#include <vector>
 #include <boost/bind/bind.hpp>
+#include <boost/asio/post.hpp>
 
 #include <gears/IOContextActiveObject.hpp>
 
@@ -61,4 +63,297 @@ namespace Gears
     Gears::Condition::Guard lock(cond_);
     impl_->io_context_work.reset();
   }
+
+  //
+  // IOContextPool::Executor class
+  //
+
+  IOContextPool::Executor::Executor(
+    boost::asio::io_context& io_context,
+    const ActiveObjectCallback_var& callback)
+    noexcept
+    : io_context_(&io_context),
+      callback_(callback)
+  {}
+
+  boost::asio::io_context&
+  IOContextPool::Executor::io_context() const noexcept
+  {
+    return *io_context_;
+  }
+
+  void
+  IOContextPool::Executor::post(Task_var task) const
+    /*throw(InvalidArgument, Gears::Exception)*/
+  {
+    static const char* FUN = "IOContextPool::Executor::post()";
+
+    if (!task)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    boost::asio::post(
+      *io_context_,
+      [task = std::move(task), callback = callback_]()
+      {
+        static const char* FUN = "IOContextPool::Executor::post()::task";
+
+        try
+        {
+          task->execute();
+        }
+        catch (const Gears::Exception& ex)
+        {
+          ErrorStream ostr;
+          ostr << FUN << ": Gears::Exception: " << ex.what();
+          callback->error(ostr.str());
+        }
+      });
+  }
+
+  //
+  // IOContextPool class
+  //
+
+  namespace
+  {
+    /**
+     * Runs a context in a pool thread until it is stopped or runs out
+     * of work
+     */
+    class IOContextJob: public ThreadJob
+    {
+    public:
+      IOContextJob(
+        boost::asio::io_context& io_context,
+        const ActiveObjectCallback_var& callback)
+        noexcept
+        : io_context_(io_context),
+          callback_(callback)
+      {}
+
+      virtual void
+      work() noexcept
+      {
+        static const char* FUN = "IOContextJob::work()";
+
+        for (;;)
+        {
+          try
+          {
+            io_context_.run();
+            return;
+          }
+          catch (const std::exception& ex)
+          {
+            // exception of a handler, the context can be run further
+            ErrorStream ostr;
+            ostr << FUN << ": handler exception: " << ex.what();
+            callback_->error(ostr.str());
+          }
+          catch (...)
+          {
+            ErrorStream ostr;
+            ostr << FUN << ": unknown handler exception";
+            callback_->error(ostr.str());
+          }
+        }
+      }
+
+    private:
+      boost::asio::io_context& io_context_;
+      const ActiveObjectCallback_var callback_;
+    };
+  }
+
+  struct IOContextPool::Impl
+  {
+    typedef std::unique_ptr<boost::asio::io_context::work> Work_var;
+
+    Impl(
+      unsigned int contexts_number,
+      const ActiveObjectCallback_var& callback,
+      const ThreadRunner::Options& thread_options)
+      /*throw(Gears::Exception)*/;
+
+    // contexts are separately allocated, so their schedulers don't
+    // share cache lines
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts;
+    std::vector<Work_var> works;
+    std::unique_ptr<ThreadRunner> thread_runner;
+  };
+
+  IOContextPool::Impl::Impl(
+    unsigned int contexts_number,
+    const ActiveObjectCallback_var& callback,
+    const ThreadRunner::Options& thread_options)
+    /*throw(Gears::Exception)*/
+    : works(contexts_number)
+  {
+    std::vector<ThreadJob_var> jobs;
+    jobs.reserve(contexts_number);
+    io_contexts.reserve(contexts_number);
+
+    for (unsigned int i = 0; i < contexts_number; ++i)
+    {
+      // single thread runs the context, asio can skip the locking
+      io_contexts.emplace_back(new boost::asio::io_context(1));
+      jobs.emplace_back(new IOContextJob(*io_contexts.back(), callback));
+    }
+
+    ThreadRunner::Options options(thread_options);
+    if (!options.thread_callback)
+    {
+      options.thread_callback = callback;
+    }
+
+    thread_runner.reset(new ThreadRunner(jobs.begin(), jobs.end(), options));
+  }
+
+  IOContextPool::IOContextPool(
+    ActiveObjectCallback_var callback,
+    unsigned int contexts_number,
+    const ThreadRunner::Options& thread_options)
+    /*throw(InvalidArgument, Gears::Exception)*/
+    : callback_(std::move(callback)),
+      next_context_(0)
+  {
+    static const char* FUN = "IOContextPool::IOContextPool()";
+
+    if (!callback_)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": callback is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    impl_.reset(new Impl(
+      contexts_(contexts_number), callback_, thread_options));
+  }
+
+  IOContextPool::~IOContextPool() noexcept
+  {
+    try
+    {
+      deactivate_object();
+      wait_object();
+    }
+    catch (...)
+    {}
+  }
+
+  unsigned int
+  IOContextPool::contexts_(unsigned int contexts_number) noexcept
+  {
+    if (contexts_number)
+    {
+      return contexts_number;
+    }
+
+    return std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  unsigned long
+  IOContextPool::size() const noexcept
+  {
+    return impl_->io_contexts.size();
+  }
+
+  boost::asio::io_context&
+  IOContextPool::io_context(unsigned long index) noexcept
+  {
+    return *impl_->io_contexts[index];
+  }
+
+  boost::asio::io_context&
+  IOContextPool::next_io_context() noexcept
+  {
+    return io_context(
+      next_context_.fetch_add(1, std::memory_order_relaxed) % size());
+  }
+
+  boost::asio::io_context&
+  IOContextPool::key_io_context(unsigned long key) noexcept
+  {
+    return io_context(key % size());
+  }
+
+  IOContextPool::Executor
+  IOContextPool::executor(unsigned long index) noexcept
+  {
+    return Executor(io_context(index), callback_);
+  }
+
+  IOContextPool::Executor
+  IOContextPool::next_executor() noexcept
+  {
+    return Executor(next_io_context(), callback_);
+  }
+
+  IOContextPool::Executor
+  IOContextPool::key_executor(unsigned long key) noexcept
+  {
+    return Executor(key_io_context(key), callback_);
+  }
+
+  void
+  IOContextPool::activate_object_()
+  {
+    for (unsigned long i = 0; i < impl_->io_contexts.size(); ++i)
+    {
+      // contexts are stopped by the previous deactivation
+      impl_->io_contexts[i]->restart();
+      impl_->works[i].reset(
+        new boost::asio::io_context::work(*impl_->io_contexts[i]));
+    }
+
+    try
+    {
+      impl_->thread_runner->start();
+    }
+    catch (...)
+    {
+      for (auto it = impl_->works.begin(); it != impl_->works.end(); ++it)
+      {
+        it->reset();
+      }
+
+      throw;
+    }
+  }
+
+  void
+  IOContextPool::deactivate_object_()
+  {
+    for (auto it = impl_->io_contexts.begin();
+      it != impl_->io_contexts.end(); ++it)
+    {
+      (*it)->stop();
+    }
+  }
+
+  void
+  IOContextPool::wait_object_()
+  {
+    impl_->thread_runner->wait_for_completion();
+
+    for (auto it = impl_->works.begin(); it != impl_->works.end(); ++it)
+    {
+      it->reset();
+    }
+  }
+
+  void
+  IOContextPool::clear() /*throw(Gears::Exception)*/
+  {
+    Gears::Condition::Guard lock(cond_);
+
+    for (auto it = impl_->works.begin(); it != impl_->works.end(); ++it)
+    {
+      it->reset();
+    }
+  }
 }
@@ -2,6 +2,11 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#  define GEARS_LISTENER_SSE
+#  include <immintrin.h>
+#endif
+
 #include <gears/Errno.hpp>
 #include <gears/Listener.hpp>
 #include <gears/Singleton.hpp>
@@ -362,6 +367,109 @@ namespace
 
     _exit(255);
   }
+
+  /**
+   * Line splitting of read buffers.
+   * Each find_new_lines_*() appends pointers to all '\n' characters of
+   * [begin, end) to line_ends in one pass over the data. Vector versions
+   * compare a block of characters at once and take line ends from
+   * the bit mask of matches, that avoids a memchr call per line
+   * for short lines.
+   */
+  namespace NewLineScan
+  {
+    typedef std::vector<const char*> LineEnds;
+
+    typedef void (*FindNewLines)(
+      const char* begin, const char* end, LineEnds& line_ends);
+
+    void
+    find_new_lines_scalar(
+      const char* begin, const char* end, LineEnds& line_ends)
+      noexcept
+    {
+      while (const char* line_end = static_cast<const char*>(
+        memchr(begin, '\n', end - begin)))
+      {
+        line_ends.push_back(line_end);
+        begin = line_end + 1;
+      }
+    }
+
+#ifdef GEARS_LISTENER_SSE
+    inline
+    void
+    push_mask_(const char* block, unsigned int mask, LineEnds& line_ends)
+      noexcept
+    {
+      for (; mask; mask &= mask - 1)
+      {
+        line_ends.push_back(block + __builtin_ctz(mask));
+      }
+    }
+
+    void
+    find_new_lines_sse2(
+      const char* begin, const char* end, LineEnds& line_ends)
+      noexcept
+    {
+      const __m128i new_line = _mm_set1_epi8('\n');
+
+      for (; end - begin >= 16; begin += 16)
+      {
+        const __m128i block = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(begin));
+        push_mask_(
+          begin,
+          _mm_movemask_epi8(_mm_cmpeq_epi8(block, new_line)),
+          line_ends);
+      }
+
+      find_new_lines_scalar(begin, end, line_ends);
+    }
+
+    __attribute__((target("avx2")))
+    void
+    find_new_lines_avx2(
+      const char* begin, const char* end, LineEnds& line_ends)
+      noexcept
+    {
+      const __m256i new_line = _mm256_set1_epi8('\n');
+
+      for (; end - begin >= 32; begin += 32)
+      {
+        const __m256i block = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(begin));
+        push_mask_(
+          begin,
+          static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, new_line))),
+          line_ends);
+      }
+
+      find_new_lines_sse2(begin, end, line_ends);
+    }
+#endif
+
+    FindNewLines
+    select_find_new_lines() noexcept
+    {
+#ifdef GEARS_LISTENER_SSE
+      __builtin_cpu_init();
+
+      if (__builtin_cpu_supports("avx2"))
+      {
+        return find_new_lines_avx2;
+      }
+
+      return find_new_lines_sse2;
+#else
+      return find_new_lines_scalar;
+#endif
+    }
+
+    const FindNewLines find_new_lines = select_find_new_lines();
+  }
 }
 
 namespace Gears
@@ -471,6 +579,41 @@ namespace Gears
     termination_pipe_.signal();
   }
 
+  void
+  DescriptorListener::add_planner(Planner_var planner)
+    /*throw (InvalidArgument, EventFailure, Gears::Exception)*/
+  {
+    static const char* FUN = "DescriptorListener::add_planner()";
+    static const char* FNE = "DescriptorListener::add_planner(): ";
+
+    if (!planner || planner->descriptor() == -1)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": planner is NULL or has no timer";
+      throw InvalidArgument(ostr.str());
+    }
+
+    planner_contexts_.emplace_back();
+    PlannerContext& context = planner_contexts_.back();
+    context.planner = std::move(planner);
+
+    event_set(&context.timer_event, context.planner->descriptor(),
+      EV_READ | EV_PERSIST, timer_callback_, &context);
+    event_base_set(base_, &context.timer_event);
+    if (event_add(&context.timer_event, 0) == -1)
+    {
+      planner_contexts_.pop_back();
+      Gears::throw_errno_exception<EventFailure>(FNE, "event_add() failed.");
+    }
+  }
+
+  void
+  DescriptorListener::timer_callback_(int /*fd*/, short /*type*/,
+    void* arg) noexcept
+  {
+    static_cast<PlannerContext*>(arg)->planner->deliver_expired();
+  }
+
   void
   DescriptorListener::read_callback_(int fd, short /*type*/, void* arg)
     noexcept
@@ -567,14 +710,26 @@ namespace Gears
         // 1. buffer can contain rest of previous read (without \n).
         const char* chunk = &context.buffer[0] + context.used_buffer;
         const char* line_start = &context.buffer[0];
-        while (const char* line_end =
-          static_cast<const char*>(memchr(chunk, '\n', res)))
+
+        line_ends_.clear();
+        NewLineScan::find_new_lines(chunk, chunk + res, line_ends_);
+
+        if (!line_ends_.empty())
         {
-          // found new line
-          callback_->on_data_ready(fd, &context - &read_contexts_[0],
-            line_start, line_end - line_start + 1);
-          res -= line_end - chunk + 1;
-          line_start = chunk = line_end + 1;
+          lines_.clear();
+
+          for (auto it = line_ends_.begin(); it != line_ends_.end(); ++it)
+          {
+            // found new line
+            lines_.push_back(SubString(line_start, *it + 1));
+            line_start = *it + 1;
+          }
+
+          callback_->on_lines_ready(fd, &context - &read_contexts_[0],
+            std::span<const SubString>(lines_));
+
+          res -= line_start - chunk;
+          chunk = line_start;
         }
         // check overflow
         if (context.used_buffer + res == BUFFERS_LENGTH_)
@@ -683,6 +838,13 @@ namespace Gears
     active_callback_->on_data_ready(fd, fd_index, buf, size);
   }
 
+  void
+  ActiveDescriptorListener::ListenerJob::DLCAdapter::on_lines_ready(
+    int fd, size_t fd_index, std::span<const SubString> lines) noexcept
+  {
+    active_callback_->on_lines_ready(fd, fd_index, lines);
+  }
+
   void
   ActiveDescriptorListener::ListenerJob::DLCAdapter::on_closed(
     int fd, size_t fd_index, int error) noexcept
@@ -786,6 +948,13 @@ namespace Gears
   ActiveDescriptorListener::~ActiveDescriptorListener() noexcept
   {}
 
+  void
+  ActiveDescriptorListener::add_planner(Planner_var planner)
+    /*throw (Gears::Exception)*/
+  {
+    static_cast<ListenerJob&>(*SINGLE_JOB_).add_planner(std::move(planner));
+  }
+
   //
   // ExecuteAndListenCallback class
   //
@@ -1,33 +1,1022 @@
+#include <exception>
+#include <unordered_map>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <gears/Errno.hpp>
 #include <gears/Planner.hpp>
 //#include <Gears/Function.hpp>
 
+namespace
+{
+  Gears::Time
+  get_monotonic_time() noexcept
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return Gears::Time(ts.tv_sec, ts.tv_nsec / 1000);
+  }
+}
+
 namespace Gears
 {
+  //
+  // Goal class
+  //
+
+  void
+  Goal::deliver_batch(const GoalArray& goals) /*throw (Gears::Exception)*/
+  {
+    std::exception_ptr error;
+
+    for (GoalArray::const_iterator it = goals.begin(); it != goals.end(); ++it)
+    {
+      try
+      {
+        (*it)->deliver();
+      }
+      catch (const Gears::Exception&)
+      {
+        if (!error)
+        {
+          error = std::current_exception();
+        }
+      }
+    }
+
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  //
+  // Planner::PlannerJob::ListGoalQueue class
+  //
+
+  class Planner::PlannerJob::ListGoalQueue: public GoalQueue
+  {
+  public:
+    ListGoalQueue() noexcept
+      : parked_(0)
+    {}
+
+    virtual bool
+    push(
+      const Time& time,
+      Goal_var goal,
+      unsigned long long id,
+      const Time& period)
+      /*throw (Gears::Exception)*/
+    {
+      TimedList::iterator itor(position_(time, messages_.end()));
+      const bool first = (itor == messages_.begin());
+
+      itor = messages_.emplace(itor, time, std::move(goal), id, period);
+
+      try
+      {
+        ids_.emplace(id, Entry{itor, false, false, Time::ZERO});
+      }
+      catch (...)
+      {
+        messages_.erase(itor);
+        throw;
+      }
+
+      return first;
+    }
+
+    virtual bool
+    move(unsigned long long id, const Time& time, bool& recheck) noexcept
+    {
+      IdMap::iterator id_it = ids_.find(id);
+
+      if (id_it == ids_.end())
+      {
+        return false;
+      }
+
+      if (id_it->second.parked)
+      {
+        // the time is used by reinsert()
+        id_it->second.moved = true;
+        id_it->second.moved_time = time;
+        return true;
+      }
+
+      TimedList::iterator msg = id_it->second.msg;
+      msg->time(time);
+
+      // splice keeps the iterator valid
+      messages_.splice(position_(time, msg), messages_, msg);
+      recheck = (msg == messages_.begin());
+
+      return true;
+    }
+
+    virtual bool
+    reinsert(TimedList& list, TimedList::iterator msg, const Time& now)
+      noexcept
+    {
+      IdMap::iterator id_it = ids_.find(msg->id());
+
+      if (id_it == ids_.end())
+      {
+        list.erase(msg);
+        return false;
+      }
+
+      Entry& entry = id_it->second;
+
+      msg->time(entry.moved ? entry.moved_time :
+        next_period_time_(msg->time(), msg->period(), now));
+
+      entry.parked = false;
+      entry.moved = false;
+      --parked_;
+
+      messages_.splice(position_(msg->time(), messages_.end()), list, msg);
+
+      return msg == messages_.begin();
+    }
+
+    virtual unsigned
+    remove(const Goal* goal) noexcept
+    {
+      unsigned removed = 0;
+
+      for (TimedList::iterator itor(messages_.begin());
+        itor != messages_.end();)
+      {
+        if (itor->is_goal(goal))
+        {
+          ids_.erase(itor->id());
+          itor = messages_.erase(itor);
+          removed++;
+        }
+        else
+        {
+          ++itor;
+        }
+      }
+
+      if (parked_)
+      {
+        // delivered periodic entries are erased by reinsert()
+        for (IdMap::iterator id_it(ids_.begin()); id_it != ids_.end();)
+        {
+          if (id_it->second.parked && id_it->second.msg->is_goal(goal))
+          {
+            id_it = ids_.erase(id_it);
+            --parked_;
+            removed++;
+          }
+          else
+          {
+            ++id_it;
+          }
+        }
+      }
+
+      return removed;
+    }
+
+    virtual bool
+    remove(unsigned long long id) noexcept
+    {
+      IdMap::iterator id_it = ids_.find(id);
+
+      if (id_it == ids_.end())
+      {
+        return false;
+      }
+
+      if (id_it->second.parked)
+      {
+        // erased by reinsert()
+        --parked_;
+      }
+      else
+      {
+        messages_.erase(id_it->second.msg);
+      }
+
+      ids_.erase(id_it);
+
+      return true;
+    }
+
+    virtual void
+    pop(const Time& now, TimedList& pending) /*throw (Gears::Exception)*/
+    {
+      while (!messages_.empty() && messages_.front().time() <= now)
+      {
+        if (messages_.front().period() > Time::ZERO)
+        {
+          ids_.find(messages_.front().id())->second.parked = true;
+          ++parked_;
+        }
+        else
+        {
+          ids_.erase(messages_.front().id());
+        }
+
+        pending.splice(pending.end(), messages_, messages_.begin());
+      }
+    }
+
+    virtual bool
+    next_time(Time& time) noexcept
+    {
+      if (messages_.empty())
+      {
+        return false;
+      }
+
+      time = messages_.front().time();
+      return true;
+    }
+
+    virtual void
+    clear() noexcept
+    {
+      messages_.clear();
+      ids_.clear();
+      parked_ = 0;
+    }
+
+    virtual unsigned long
+    size() const noexcept
+    {
+      return ids_.size();
+    }
+
+  private:
+    struct Entry
+    {
+      // points into the pending list while the entry is parked
+      TimedList::iterator msg;
+      // periodic entry is delivered now
+      bool parked;
+      // parked entry is rescheduled
+      bool moved;
+      // time of the rescheduled parked entry, its message is read by
+      // the working thread without the lock until reinsert()
+      Time moved_time;
+    };
+
+    typedef std::unordered_map<unsigned long long, Entry> IdMap;
+
+    /**
+     * Searches from the end for the position of a message with the time
+     * @param skip message to ignore in the search
+     */
+    TimedList::iterator
+    position_(const Time& time, TimedList::iterator skip) noexcept
+    {
+      TimedList::iterator itor(messages_.end());
+
+      while (itor != messages_.begin())
+      {
+        --itor;
+        if (itor != skip && itor->time() < time)
+        {
+          ++itor;
+          break;
+        }
+      }
+
+      return itor;
+    }
+
+  private:
+    TimedList messages_;
+    IdMap ids_;
+    unsigned long parked_;
+  };
+
+  //
+  // Planner::PlannerJob::TimingWheelGoalQueue class
+  //
+
+  /**
+   * Hierarchical timing wheel: LEVELS wheels of SLOTS slots, a slot of
+   * level i covers SLOTS^i milliseconds. Goal is linked into the slot of
+   * the lowest level whose span covers the distance to it, slots of
+   * upper levels are moved down (cascaded) when the current tick enters
+   * them. Goals further than all levels wait in the overflow list.
+   * Schedule and unschedule are O(1), unschedule finds goal entries
+   * through the index by goal pointer.
+   */
+  class Planner::PlannerJob::TimingWheelGoalQueue: public GoalQueue
+  {
+  public:
+    /**
+     * @param now current time of the queue clock
+     */
+    explicit
+    TimingWheelGoalQueue(const Time& now) noexcept
+      : current_(tick_(now)),
+        next_check_valid_(false)
+    {
+      for (unsigned long level = 0; level <= LEVELS; ++level)
+      {
+        counts_[level] = 0;
+      }
+
+      for (unsigned long level = 0; level < LEVELS; ++level)
+      {
+        for (unsigned long slot = 0; slot < SLOTS; ++slot)
+        {
+          wheels_[level][slot].reset();
+        }
+      }
+
+      overflow_.reset();
+    }
+
+    virtual
+    ~TimingWheelGoalQueue() noexcept
+    {
+      clear();
+    }
+
+    virtual bool
+    push(
+      const Time& time,
+      Goal_var goal,
+      unsigned long long id,
+      const Time& period)
+      /*throw (Gears::Exception)*/
+    {
+      const Goal* goal_ptr = goal.get();
+      std::unique_ptr<Node> node(
+        new Node(time, std::move(goal), id, period));
+      node->index_it = index_.emplace(goal_ptr, node.get());
+
+      try
+      {
+        ids_.emplace(id, node.get());
+      }
+      catch (...)
+      {
+        index_.erase(node->index_it);
+        throw;
+      }
+
+      insert_(node.release());
+
+      return update_next_check_(time);
+    }
+
+    virtual bool
+    move(unsigned long long id, const Time& time, bool& recheck) noexcept
+    {
+      IdMap::iterator id_it = ids_.find(id);
+
+      if (id_it == ids_.end())
+      {
+        return false;
+      }
+
+      Node* node = id_it->second;
+      node->time = time;
+      node->tick = tick_(time);
+
+      if (node->parked)
+      {
+        // the time is used by reinsert()
+        node->moved = true;
+        return true;
+      }
+
+      unlink_(node);
+      insert_(node);
+      recheck = update_next_check_(time);
+
+      return true;
+    }
+
+    virtual bool
+    reinsert(TimedList& list, TimedList::iterator msg, const Time& now)
+      noexcept
+    {
+      IdMap::iterator id_it = ids_.find(msg->id());
+
+      if (id_it == ids_.end())
+      {
+        list.erase(msg);
+        return false;
+      }
+
+      Node* node = id_it->second;
+
+      if (!node->moved)
+      {
+        node->time = next_period_time_(node->time, node->period, now);
+        node->tick = tick_(node->time);
+      }
+
+      node->parked = false;
+      node->moved = false;
+      insert_(node);
+
+      // keep the message for the next delivery
+      msg->goal().reset();
+      spare_.splice(spare_.end(), list, msg);
+
+      return update_next_check_(node->time);
+    }
+
+    virtual unsigned
+    remove(const Goal* goal) noexcept
+    {
+      auto range = index_.equal_range(goal);
+      unsigned removed = 0;
+
+      for (auto it = range.first; it != range.second; ++it)
+      {
+        if (!it->second->parked)
+        {
+          unlink_(it->second);
+        }
+
+        ids_.erase(it->second->id);
+        delete it->second;
+        ++removed;
+      }
+
+      index_.erase(range.first, range.second);
+
+      return removed;
+    }
+
+    virtual bool
+    remove(unsigned long long id) noexcept
+    {
+      IdMap::iterator id_it = ids_.find(id);
+
+      if (id_it == ids_.end())
+      {
+        return false;
+      }
+
+      Node* node = id_it->second;
+
+      if (!node->parked)
+      {
+        unlink_(node);
+      }
+
+      index_.erase(node->index_it);
+      ids_.erase(id_it);
+      delete node;
+
+      return true;
+    }
+
+    virtual void
+    pop(const Time& now, TimedList& pending) /*throw (Gears::Exception)*/
+    {
+      const unsigned long long target = tick_(now);
+
+      for (;;)
+      {
+        take_due_(wheels_[0][current_ & SLOT_MASK], now, pending);
+
+        if (current_ >= target)
+        {
+          break;
+        }
+
+        // skip ticks while the lower levels are empty
+        unsigned long level = 0;
+
+        while (level <= LEVELS && !counts_[level])
+        {
+          ++level;
+        }
+
+        unsigned long long next;
+
+        if (level == 0)
+        {
+          next = current_ + 1;
+        }
+        else if (level > LEVELS)
+        {
+          next = target;
+        }
+        else
+        {
+          next = (current_ | ((1ull << (LEVEL_BITS * level)) - 1)) + 1;
+        }
+
+        if (next > target)
+        {
+          // no slot is entered before target
+          current_ = target;
+        }
+        else
+        {
+          current_ = next;
+
+          if (!(current_ & SLOT_MASK))
+          {
+            cascade_(1);
+          }
+        }
+      }
+    }
+
+    virtual bool
+    next_time(Time& time) noexcept
+    {
+      next_check_valid_ = find_next_time_(next_check_);
+      time = next_check_;
+      return next_check_valid_;
+    }
+
+    virtual void
+    clear() noexcept
+    {
+      for (auto it = index_.begin(); it != index_.end(); ++it)
+      {
+        if (!it->second->parked)
+        {
+          unlink_(it->second);
+        }
+
+        delete it->second;
+      }
+
+      index_.clear();
+      ids_.clear();
+      spare_.clear();
+      next_check_valid_ = false;
+    }
+
+    virtual unsigned long
+    size() const noexcept
+    {
+      return ids_.size();
+    }
+
+  private:
+    static const unsigned long LEVEL_BITS = 8;
+    static const unsigned long SLOTS = 1ul << LEVEL_BITS;
+    static const unsigned long SLOT_MASK = SLOTS - 1;
+    static const unsigned long LEVELS = 4;
+
+    struct Node;
+
+    typedef std::unordered_multimap<const Goal*, Node*> GoalIndex;
+    typedef std::unordered_map<unsigned long long, Node*> IdMap;
+
+    /**
+     * Link of intrusive circular list, slot is a list head
+     */
+    struct Link
+    {
+      void
+      reset() noexcept
+      {
+        prev = next = this;
+      }
+
+      bool
+      empty() const noexcept
+      {
+        return next == this;
+      }
+
+      Link* prev;
+      Link* next;
+    };
+
+    struct Node: public Link
+    {
+      Node(
+        const Time& time_val,
+        Goal_var goal_val,
+        unsigned long long id_val,
+        const Time& period_val)
+        noexcept
+        : time(time_val),
+          goal(std::move(goal_val)),
+          id(id_val),
+          period(period_val),
+          tick(tick_(time_val)),
+          level(0),
+          parked(false),
+          moved(false)
+      {}
+
+      Time time;
+      Goal_var goal;
+      unsigned long long id;
+      Time period;
+      unsigned long long tick;
+      // LEVELS for the overflow list
+      unsigned long level;
+      // periodic node is delivered now, it isn't linked
+      bool parked;
+      // parked node is rescheduled
+      bool moved;
+      GoalIndex::iterator index_it;
+    };
+
+    static
+    unsigned long long
+    tick_(const Time& time) noexcept
+    {
+      const long long usec = time.microseconds();
+      return usec > 0 ? usec / 1000 : 0;
+    }
+
+    static
+    Time
+    tick_time_(unsigned long long tick) noexcept
+    {
+      return Time(tick / 1000, (tick % 1000) * 1000);
+    }
+
+    /**
+     * @return true if the time is before the time the working thread
+     * checks the queue at
+     */
+    bool
+    update_next_check_(const Time& time) noexcept
+    {
+      if (!next_check_valid_ || time < next_check_)
+      {
+        next_check_ = time;
+        next_check_valid_ = true;
+        return true;
+      }
+
+      return false;
+    }
+
+    void
+    insert_(Node* node) noexcept
+    {
+      const unsigned long long expires = std::max(node->tick, current_);
+      const unsigned long long delta = expires - current_;
+
+      unsigned long level = 0;
+
+      while (level < LEVELS && delta >= (1ull << (LEVEL_BITS * (level + 1))))
+      {
+        ++level;
+      }
+
+      Link* head = level < LEVELS ?
+        &wheels_[level][(expires >> (LEVEL_BITS * level)) & SLOT_MASK] :
+        &overflow_;
+
+      node->level = level;
+      node->prev = head->prev;
+      node->next = head;
+      head->prev->next = node;
+      head->prev = node;
+      ++counts_[level];
+    }
+
+    void
+    unlink_(Node* node) noexcept
+    {
+      node->prev->next = node->next;
+      node->next->prev = node->prev;
+      --counts_[node->level];
+    }
+
+    /**
+     * Moves the slot of the level entered by the current tick to lower
+     * levels, continues on the upper level if this one wrapped
+     */
+    void
+    cascade_(unsigned long level) noexcept
+    {
+      Link* head;
+
+      if (level < LEVELS)
+      {
+        head = &wheels_[level][
+          (current_ >> (LEVEL_BITS * level)) & SLOT_MASK];
+      }
+      else
+      {
+        head = &overflow_;
+      }
+
+      Link list;
+      list.reset();
+
+      if (!head->empty())
+      {
+        // detach the slot, nodes can be linked back into it
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head->reset();
+      }
+
+      while (!list.empty())
+      {
+        Node* node = static_cast<Node*>(list.next);
+        list.next = node->next;
+        node->next->prev = &list;
+        --counts_[node->level];
+        insert_(node);
+      }
+
+      if (level < LEVELS &&
+          !((current_ >> (LEVEL_BITS * level)) & SLOT_MASK))
+      {
+        cascade_(level + 1);
+      }
+    }
+
+    void
+    take_due_(Link& head, const Time& now, TimedList& pending)
+      /*throw (Gears::Exception)*/
+    {
+      TimedList due;
+
+      for (Link* link = head.next; link != &head;)
+      {
+        Node* node = static_cast<Node*>(link);
+        link = link->next;
+
+        if (node->time <= now)
+        {
+          if (node->period > Time::ZERO)
+          {
+            // the node waits for reinsert()
+            if (spare_.empty())
+            {
+              due.emplace_back();
+            }
+            else
+            {
+              due.splice(due.end(), spare_, spare_.begin());
+            }
+
+            due.back() = TimedMessage(
+              node->time, node->goal, node->id, node->period);
+            unlink_(node);
+            node->parked = true;
+          }
+          else
+          {
+            due.emplace_back(node->time, std::move(node->goal));
+            unlink_(node);
+            index_.erase(node->index_it);
+            ids_.erase(node->id);
+            delete node;
+          }
+        }
+      }
+
+      if (!due.empty())
+      {
+        due.sort(
+          [](const TimedMessage& left, const TimedMessage& right)
+          {
+            return left.time() < right.time();
+          });
+
+        pending.splice(pending.end(), due);
+      }
+    }
+
+    /**
+     * @return the earliest of the first level 0 goal time and the times
+     * upper level slots and the overflow list must be cascaded at
+     */
+    bool
+    find_next_time_(Time& time) const noexcept
+    {
+      bool found = false;
+
+      if (counts_[0])
+      {
+        // level 0 holds ticks [current_, current_ + SLOTS)
+        for (unsigned long i = 0; i < SLOTS; ++i)
+        {
+          const Link& head = wheels_[0][(current_ + i) & SLOT_MASK];
+
+          if (!head.empty())
+          {
+            time = static_cast<const Node*>(head.next)->time;
+
+            for (const Link* link = head.next->next; link != &head;
+              link = link->next)
+            {
+              time = std::min(time, static_cast<const Node*>(link)->time);
+            }
+
+            found = true;
+            break;
+          }
+        }
+      }
+
+      // wake up to cascade the first not empty slot of upper levels,
+      // its boundary can come before the level 0 goal
+      for (unsigned long level = 1; level < LEVELS; ++level)
+      {
+        if (counts_[level])
+        {
+          const unsigned long long base = current_ >> (LEVEL_BITS * level);
+
+          for (unsigned long i = 1; i <= SLOTS; ++i)
+          {
+            if (!wheels_[level][(base + i) & SLOT_MASK].empty())
+            {
+              update_time_(
+                time,
+                found,
+                tick_time_((base + i) << (LEVEL_BITS * level)));
+              break;
+            }
+          }
+        }
+      }
+
+      if (counts_[LEVELS])
+      {
+        update_time_(
+          time,
+          found,
+          tick_time_(
+            ((current_ >> (LEVEL_BITS * LEVELS)) + 1) <<
+            (LEVEL_BITS * LEVELS)));
+      }
+
+      return found;
+    }
+
+    static
+    void
+    update_time_(Time& time, bool& found, const Time& candidate) noexcept
+    {
+      if (!found || candidate < time)
+      {
+        time = candidate;
+        found = true;
+      }
+    }
+
+  private:
+    Link wheels_[LEVELS][SLOTS];
+    Link overflow_;
+    unsigned long counts_[LEVELS + 1];
+    GoalIndex index_;
+    IdMap ids_;
+    unsigned long long current_;
+    // messages of reinserted periodic nodes
+    TimedList spare_;
+
+    // lower bound of the time the working thread checks the queue at
+    Time next_check_;
+    bool next_check_valid_;
+  };
+
   //
   // Planner::PlannerJob class
   //
 
   Planner::PlannerJob::PlannerJob(
     ActiveObjectCallback_var callback,
-    bool delivery_time_adjustment)
-    /*throw (Gears::Exception)*/
+    bool delivery_time_adjustment,
+    QueueType queue_type,
+    ClockType clock_type,
+    SharedExecutor_var executor)
+    /*throw (Exception, Gears::Exception)*/
     : SingleJob(std::move(callback)),
+      SharedExecutor::Source(1, true),
       have_new_events_(false),
-      delivery_time_adjustment_(delivery_time_adjustment)
-  {}
+      messages_(create_queue_(
+        queue_type,
+        clock_type == CT_MONOTONIC ?
+          get_monotonic_time() : Time::get_time_of_day())),
+      last_id_(0),
+      max_pending_goals_(0),
+      delivery_time_adjustment_(delivery_time_adjustment),
+      timer_fd_(-1),
+      timer_armed_(false),
+      executor_(std::move(executor))
+  {
+    if (clock_type == CT_MONOTONIC)
+    {
+      timer_fd_ = timerfd_create(
+        CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+      if (timer_fd_ == -1)
+      {
+        throw_errno_exception<Exception>(
+          "Planner::PlannerJob::PlannerJob(): ", "timerfd_create() failed");
+      }
+    }
+  }
+
+  Planner::PlannerJob::GoalQueue_var
+  Planner::PlannerJob::create_queue_(QueueType queue_type, const Time& now)
+    /*throw (Gears::Exception)*/
+  {
+    if (queue_type == QT_TIMING_WHEEL)
+    {
+      return GoalQueue_var(new TimingWheelGoalQueue(now));
+    }
+
+    return GoalQueue_var(new ListGoalQueue());
+  }
+
+  Time
+  Planner::PlannerJob::next_period_time_(
+    const Time& time,
+    const Time& period,
+    const Time& now)
+    noexcept
+  {
+    Time next(time + period);
+
+    if (next <= now)
+    {
+      // skip missed periods keeping the phase
+      const long long period_usec = period.microseconds();
+      const long long usec = next.microseconds() +
+        ((now - next).microseconds() / period_usec + 1) * period_usec;
+      next = Time(usec / Time::USEC_MAX, usec % Time::USEC_MAX);
+    }
+
+    return next;
+  }
 
   Planner::PlannerJob::~PlannerJob() noexcept
-  {}
+  {
+    if (executor_)
+    {
+      // planner destroyed without deactivation
+      executor_->detach(this);
+
+      try
+      {
+        executor_->wait_detached(this);
+      }
+      catch (...)
+      {}
+    }
+
+    if (timer_fd_ != -1)
+    {
+      close(timer_fd_);
+    }
+  }
+
+  void
+  Planner::PlannerJob::started(unsigned /*threads*/) noexcept
+  {
+    if (executor_)
+    {
+      // the executor timer is set by goals scheduled before
+      executor_->attach(this);
+    }
+  }
 
   void
   Planner::PlannerJob::terminate() noexcept
   {
+    if (executor_)
+    {
+      executor_->detach(this);
+      return;
+    }
+
+    if (timer_fd_ != -1)
+    {
+      // expire the timer to wake the working thread
+      Condition::Guard guard(new_event_in_schedule_);
+      set_timer_(&Time::ZERO);
+      timer_armed_ = false;
+      return;
+    }
+
     have_new_events_ = true;
     new_event_in_schedule_.signal(); // wake the working thread
   }
 
-  void
-  Planner::PlannerJob::schedule(Goal_var goal, const Time& time)
+  unsigned long long
+  Planner::PlannerJob::schedule(
+    Goal_var goal,
+    const Time& time,
+    const Time& period)
     /*throw (InvalidArgument, Exception, Gears::Exception)*/
   {
     static const char* FUN = "Planner::PlannerJob::schedule()";
@@ -39,66 +1028,63 @@ namespace Gears
       throw InvalidArgument(ostr.str());
     }
 
-    Time tm(time > Time::ZERO ? time : Time::ZERO);
+    Time tm(queue_time_(time));
 
     bool signal;
+    unsigned long long id;
     {
-      /** sch 1: add message into list */
+      /** sch 1: add message into queue */
       Condition::Guard guard(new_event_in_schedule_);
 
-      TimedList::iterator itor(messages_.end());
-
-      while (itor != messages_.begin())
-      {
-        --itor;
-        if (itor->time() < tm)
-        {
-          ++itor;
-          break;
-        }
-      }
-
-      signal = (itor == messages_.begin());
-
-      TimedMessage m(tm, goal);
-      messages_.emplace(itor, m);
-      if (signal)
-      {
-        have_new_events_ = true;
-      }
+      id = ++last_id_;
+      signal = messages_->push(tm, std::move(goal), id, period) && wake_();
+      max_pending_goals_ = std::max(max_pending_goals_, messages_->size());
     }
     if (signal)
     {
       /** sch 2: new events into schedule signal */
       new_event_in_schedule_.signal();
     }
+
+    return id;
   }
 
-  unsigned
-  Planner::PlannerJob::unschedule(const Goal* goal)
+  bool
+  Planner::PlannerJob::reschedule(unsigned long long id, const Time& time)
     /*throw (Gears::Exception)*/
   {
-    unsigned removed = 0;
+    Time tm(queue_time_(time));
 
+    bool found;
+    bool signal = false;
     {
       Condition::Guard guard(new_event_in_schedule_);
 
-      for (TimedList::iterator itor(messages_.begin());
-        itor != messages_.end();)
-      {
-        if (itor->is_goal(goal))
-        {
-          itor = messages_.erase(itor);
-          removed++;
-        }
-        else
-        {
-          ++itor;
-        }
-      }
+      found = messages_->move(id, tm, signal);
+      signal = signal && wake_();
     }
+    if (signal)
+    {
+      new_event_in_schedule_.signal();
+    }
+
+    return found;
+  }
+
+  bool
+  Planner::PlannerJob::unschedule(unsigned long long id)
+    /*throw (Gears::Exception)*/
+  {
+    Condition::Guard guard(new_event_in_schedule_);
+    return messages_->remove(id);
+  }
 
-    return removed;
+  unsigned
+  Planner::PlannerJob::unschedule(const Goal* goal)
+    /*throw (Gears::Exception)*/
+  {
+    Condition::Guard guard(new_event_in_schedule_);
+    return messages_->remove(goal);
   }
 
   void
@@ -108,6 +1094,12 @@ namespace Gears
 
     try
     {
+      if (timer_fd_ != -1)
+      {
+        work_timer_();
+        return;
+      }
+
       TimedList pending;
       Time abs_time;
       Time cur_time;
@@ -126,10 +1118,16 @@ namespace Gears
           }
           cur_time = Time::get_time_of_day();
 
-          while (!messages_.empty())  // pump messages to pending.
-          {
-            abs_time = messages_.front().time();
+          // pump all overdue event to pending list.
+          //  They will call immediately
+          messages_->pop(
+            delivery_time_adjustment_ ?
+              cur_time + delivery_time_shift_ :
+              cur_time,
+            pending);
 
+          if (messages_->next_time(abs_time))
+          {
             if (delivery_time_adjustment_)
             {
               abs_time = abs_time > delivery_time_shift_ ?
@@ -137,18 +1135,7 @@ namespace Gears
                 Time::ZERO;
             }
 
-            // pump all overdue event to pending list.
-            //  They will call immediately
-            if (abs_time <= cur_time)
-            {
-              pending.splice(pending.end(), std::move(messages_),
-                messages_.begin());
-            }
-            else
-            {
-              pabs_time = &abs_time;  // first event in the future
-              break;
-            }
+            pabs_time = &abs_time;  // first event in the future
           }
         } // end data lock
 
@@ -203,8 +1190,82 @@ namespace Gears
         } // if (pending.empty())
 
         /** svc 3: deliver pending tasks */
-        while (!pending.empty())
+        deliver_(pending, cur_time);
+      }
+    }
+    catch (const Gears::Exception& e)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": Gears::Exception caught: " << e.what();
+      callback()->critical(ostr.str());
+    }
+  }
+
+  void
+  Planner::PlannerJob::deliver_(TimedList& pending, const Time& start)
+    noexcept
+  {
+    static const char* FUN = "Planner::PlannerJob::deliver_()";
+
+    if (pending.empty())
+    {
+      return;
+    }
+
+    // the end of the previous delivery is the start of the next one
+    Time now = current_time_();
+
+    try
+    {
+      while (!pending.empty())
+      {
+        const void* key = pending.front().goal()->batch_key();
+
+        if (key)
+        {
+          // run of adjacent goals with the key, so the order of
+          // delivery is kept
+          const Time batch_time = pending.front().time();
+
+          do
+          {
+            if (pending.front().period() > Time::ZERO)
+            {
+              batch_.push_back(pending.front().goal());
+            }
+            else
+            {
+              batch_.push_back(std::move(pending.front().goal()));
+            }
+
+            release_pending_(pending);
+          }
+          while (!pending.empty() &&
+            pending.front().goal()->batch_key() == key);
+
+          lateness_.add(now - batch_time, batch_.size());
+
+          try
+          {
+            batch_.front()->deliver_batch(batch_);
+          }
+          catch (const Gears::Exception& ex)
+          {
+            callback()->error(Gears::SubString(ex.what()));
+          }
+
+          const Time delivered(current_time_());
+          delivery_.add(
+            (delivered - now) / static_cast<int>(batch_.size()),
+            batch_.size());
+          now = delivered;
+
+          batch_.clear();
+        }
+        else
         {
+          lateness_.add(now - pending.front().time());
+
           try
           {
             pending.front().deliver();
@@ -214,40 +1275,399 @@ namespace Gears
             callback()->error(Gears::SubString(ex.what()));
           }
 
-          pending.pop_front();
+          const Time delivered(current_time_());
+          delivery_.add(delivered - now);
+          now = delivered;
+
+          release_pending_(pending);
         }
       }
     }
-    catch (const Gears::Exception& e)
+    catch (const Gears::Exception& ex)
     {
       ErrorStream ostr;
-      ostr << FUN << ": Gears::Exception caught: " << e.what();
+      ostr << FUN << ": Gears::Exception caught: " << ex.what();
+      callback()->error(ostr.str());
+
+      batch_.clear();
+
+      // periodic entries must return into the queue
+      while (!pending.empty())
+      {
+        release_pending_(pending);
+      }
+    }
+
+    busy_.add(now - start);
+
+    if (!periodic_.empty())
+    {
+      bool signal = false;
+
+      {
+        Condition::Guard guard(new_event_in_schedule_);
+
+        const Time now = current_time_();
+
+        while (!periodic_.empty())
+        {
+          if (messages_->reinsert(periodic_, periodic_.begin(), now))
+          {
+            signal = wake_() || signal;
+          }
+        }
+      }
+
+      if (signal)
+      {
+        new_event_in_schedule_.signal();
+      }
+    }
+  }
+
+  void
+  Planner::PlannerJob::release_pending_(TimedList& pending) noexcept
+  {
+    if (pending.front().period() > Time::ZERO)
+    {
+      periodic_.splice(periodic_.end(), pending, pending.begin());
+    }
+    else
+    {
+      pending.pop_front();
+    }
+  }
+
+  void
+  Planner::PlannerJob::work_timer_() /*throw (Gears::Exception)*/
+  {
+    static const char* FNE = "Planner::PlannerJob::work_timer_(): ";
+
+    {
+      // goals scheduled while the object wasn't active
+      Condition::Guard guard(new_event_in_schedule_);
+      arm_timer_();
+    }
+
+    while (!is_terminating())
+    {
+      pollfd timer = {timer_fd_, POLLIN, 0};
+
+      if (poll(&timer, 1, -1) == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        throw_errno_exception<Exception>(FNE, "poll() failed");
+      }
+
+      if (is_terminating())
+      {
+        break;
+      }
+
+      deliver_expired();
+    }
+  }
+
+  void
+  Planner::PlannerJob::deliver_expired() noexcept
+  {
+    static const char* FUN = "Planner::PlannerJob::deliver_expired()";
+
+    TimedList pending;
+    Time cur_time;
+
+    try
+    {
+      Condition::Guard guard(new_event_in_schedule_);
+
+      cur_time = current_time_();
+
+      // unit of the executor is added by the expired timer
+      uint64_t expirations;
+      if ((executor_ ||
+           read(timer_fd_, &expirations, sizeof(expirations)) ==
+             sizeof(expirations)) &&
+          timer_armed_)
+      {
+        if (delivery_time_adjustment_ && cur_time > armed_time_)
+        {
+          delivery_time_shift_ = (cur_time - armed_time_) / 2;
+        }
+
+        timer_armed_ = false;
+      }
+
+      messages_->pop(
+        delivery_time_adjustment_ ?
+          cur_time + delivery_time_shift_ :
+          cur_time,
+        pending);
+
+      arm_timer_();
+    }
+    catch (const Gears::Exception& ex)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": Gears::Exception caught: " << ex.what();
       callback()->critical(ostr.str());
     }
+
+    deliver_(pending, cur_time);
+  }
+
+  void
+  Planner::PlannerJob::execute_unit() noexcept
+  {
+    deliver_expired();
+  }
+
+  void
+  Planner::PlannerJob::wait_detached() /*throw (Gears::Exception)*/
+  {
+    if (executor_)
+    {
+      executor_->wait_detached(this);
+    }
+  }
+
+  Planner::Stats
+  Planner::PlannerJob::stats() const noexcept
+  {
+    Stats stats;
+
+    lateness_.collect(stats.lateness);
+    delivery_.collect(stats.delivery);
+    busy_.collect(stats.busy);
+
+    Condition::Guard guard(new_event_in_schedule_);
+    stats.pending_goals = messages_->size();
+    stats.max_pending_goals = max_pending_goals_;
+
+    return stats;
+  }
+
+  int
+  Planner::PlannerJob::descriptor() const noexcept
+  {
+    return timer_fd_;
+  }
+
+  Time
+  Planner::PlannerJob::current_time_() const noexcept
+  {
+    return timer_fd_ != -1 ? get_monotonic_time() : Time::get_time_of_day();
+  }
+
+  Time
+  Planner::PlannerJob::queue_time_(const Time& time) const noexcept
+  {
+    if (timer_fd_ == -1)
+    {
+      return time > Time::ZERO ? time : Time::ZERO;
+    }
+
+    // keep the interval to the goal on the monotonic clock
+    const Time now = Time::get_time_of_day();
+    const Time monotonic_now = get_monotonic_time();
+
+    if (time >= now)
+    {
+      return monotonic_now + (time - now);
+    }
+
+    const Time overdue = now - time;
+    return monotonic_now > overdue ? monotonic_now - overdue : Time::ZERO;
+  }
+
+  bool
+  Planner::PlannerJob::wake_() noexcept
+  {
+    if (timer_fd_ != -1 || executor_)
+    {
+      arm_timer_();
+      return false;
+    }
+
+    have_new_events_ = true;
+    return true;
+  }
+
+  void
+  Planner::PlannerJob::arm_timer_() noexcept
+  {
+    Time time;
+
+    if (!messages_->next_time(time))
+    {
+      if (timer_armed_)
+      {
+        set_timer_(0);
+        timer_armed_ = false;
+      }
+
+      return;
+    }
+
+    if (delivery_time_adjustment_)
+    {
+      time = time > delivery_time_shift_ ?
+        time - delivery_time_shift_ :
+        Time::ZERO;
+    }
+
+    if (!timer_armed_ || time != armed_time_)
+    {
+      set_timer_(&time);
+      armed_time_ = time;
+      timer_armed_ = true;
+    }
+  }
+
+  void
+  Planner::PlannerJob::set_timer_(const Time* time) noexcept
+  {
+    static const char* FNE = "Planner::PlannerJob::set_timer_(): ";
+
+    if (executor_)
+    {
+      executor_->set_timer(this, time);
+      return;
+    }
+
+    itimerspec spec = itimerspec();
+
+    if (time)
+    {
+      spec.it_value.tv_sec = time->tv_sec;
+      spec.it_value.tv_nsec = time->tv_usec * 1000;
+
+      if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+      {
+        // zero value disarms the timer, expire it at once
+        spec.it_value.tv_nsec = 1;
+      }
+    }
+
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, 0) == -1)
+    {
+      char error[256];
+      ErrnoHelper::compose_safe(error, sizeof(error), errno,
+        FNE, "timerfd_settime() failed");
+      callback()->critical(Gears::SubString(error));
+    }
   }
 
   void
   Planner::PlannerJob::clear() noexcept
   {
     Condition::Guard guard(new_event_in_schedule_);
-    messages_.clear();
+    messages_->clear();
   }
 
   //
   // Planner class
   //
 
+  Planner::Planner(
+    ActiveObjectCallback_var callback,
+    const ThreadRunner::Options& thread_options,
+    bool delivery_time_adjustment,
+    QueueType queue_type,
+    ClockType clock_type)
+    /*throw (InvalidArgument, Exception, Gears::Exception)*/
+    : ActiveObjectCommonImpl(
+        PlannerJob_var(new PlannerJob(
+          std::move(callback),
+          delivery_time_adjustment,
+          queue_type,
+          clock_type)),
+        1, thread_options),
+      job_(static_cast<PlannerJob&>(*SINGLE_JOB_))
+  {}
+
   Planner::Planner(
     ActiveObjectCallback_var callback,
     size_t stack_size,
-    bool delivery_time_adjustment) /*throw (InvalidArgument, Gears::Exception)*/
+    bool delivery_time_adjustment)
+    /*throw (InvalidArgument, Exception, Gears::Exception)*/
+    : Planner(
+        std::move(callback),
+        ThreadRunner::Options(stack_size),
+        delivery_time_adjustment)
+  {}
+
+  Planner::Planner(
+    ActiveObjectCallback_var callback,
+    SharedExecutor_var executor,
+    bool delivery_time_adjustment,
+    QueueType queue_type)
+    /*throw (InvalidArgument, Exception, Gears::Exception)*/
     : ActiveObjectCommonImpl(
-        PlannerJob_var(
-          new PlannerJob(std::move(callback), delivery_time_adjustment)),
-        1, stack_size),
+        PlannerJob_var(new PlannerJob(
+          std::move(callback),
+          delivery_time_adjustment,
+          queue_type,
+          CT_REALTIME,
+          check_executor_(executor))),
+        ExternalThreads()),
       job_(static_cast<PlannerJob&>(*SINGLE_JOB_))
   {}
 
   Planner::~Planner() noexcept
   {}
+
+  void
+  Planner::wait_object() /*throw (Exception, Gears::Exception)*/
+  {
+    job_.wait_detached();
+    ActiveObjectCommonImpl::wait_object();
+  }
+
+  SharedExecutor_var
+  Planner::check_executor_(const SharedExecutor_var& executor)
+    /*throw (InvalidArgument)*/
+  {
+    static const char* FUN = "Planner::check_executor_()";
+
+    if (!executor)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": executor is null";
+      throw InvalidArgument(ostr.str());
+    }
+
+    return executor;
+  }
+
+  //
+  // Planner::Stats class
+  //
+
+  Planner::Stats::Stats() noexcept
+    : pending_goals(0),
+      max_pending_goals(0)
+  {}
+
+  Planner::Handle
+  Planner::schedule_periodic(
+    Goal_var goal,
+    const Time& first_time,
+    const Time& period)
+    /*throw (InvalidArgument, Exception, Gears::Exception)*/
+  {
+    static const char* FUN = "Planner::schedule_periodic()";
+
+    if (period <= Time::ZERO)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": period isn't positive";
+      throw InvalidArgument(ostr.str());
+    }
+
+    return Handle(job_.schedule(std::move(goal), first_time, period));
+  }
 }
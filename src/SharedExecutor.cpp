@@ -0,0 +1,617 @@
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <gears/SharedExecutor.hpp>
+
+namespace Gears
+{
+  //
+  // SharedExecutor::ExecutorJob class
+  //
+
+  class SharedExecutor::ExecutorJob: public SingleJob
+  {
+  public:
+    ExecutorJob(
+      ActiveObjectCallback_var callback,
+      unsigned long threads_number)
+      /*throw(InvalidArgument, Gears::Exception)*/;
+
+    virtual
+    ~ExecutorJob() noexcept = default;
+
+    virtual void
+    work() noexcept;
+
+    virtual void
+    terminate() noexcept;
+
+    void
+    attach(Source* source) noexcept;
+
+    void
+    detach(Source* source) noexcept;
+
+    void
+    wait_detached(Source* source) /*throw(Gears::Exception)*/;
+
+    void
+    post(Source* source, unsigned long units) noexcept;
+
+    void
+    set_timer(Source* source, const Time* time) noexcept;
+
+    unsigned long
+    thread_count() const noexcept;
+
+  private:
+    /**
+     * Adds units to the source, puts it into the ring
+     * if it is attached
+     */
+    void
+    add_units_(Source* source, unsigned long units) noexcept;
+
+    void
+    link_(Source* source) noexcept;
+
+    void
+    unlink_(Source* source) noexcept;
+
+    /**
+     * Wakes up to units idle threads, the timer waiter if there are
+     * no idle threads
+     */
+    void
+    wake_(unsigned long units) noexcept;
+
+    /**
+     * Makes a thread wait for the nearest timer
+     */
+    void
+    wake_timer_() noexcept;
+
+    /**
+     * Adds units to the sources with due timers, recounts
+     * the nearest timer
+     */
+    void
+    fire_timers_(const Time& now) noexcept;
+
+    /**
+     * Takes a unit of the next source in the ring
+     * @return NULL if there are no units that can be executed now
+     */
+    Source*
+    next_unit_() noexcept;
+
+    /**
+     * Accounts the executed unit
+     */
+    void
+    unit_finished_(Source* source) noexcept;
+
+    /**
+     * Waits for units or for the nearest timer
+     */
+    void
+    wait_() /*throw(Gears::Exception)*/;
+
+  private:
+    const unsigned long THREADS_NUMBER_;
+
+    Mutex lock_;
+    // idle threads wait for units
+    Conditional work_;
+    // one idle thread waits for the nearest timer
+    Conditional timer_;
+    // wait_detached() callers
+    Conditional detached_;
+
+    std::vector<Source*> sources_;
+    // ring position and number of units it can execute in a row
+    Source* current_;
+    unsigned long credit_;
+
+    unsigned long idle_threads_;
+    bool timer_waiter_;
+    // number of attached sources with timers and the nearest time,
+    // it can be earlier than actual one after timer changes
+    unsigned long timers_;
+    Time nearest_timer_;
+  };
+
+  SharedExecutor::ExecutorJob::ExecutorJob(
+    ActiveObjectCallback_var callback,
+    unsigned long threads_number)
+    /*throw(InvalidArgument, Gears::Exception)*/
+    : SingleJob(std::move(callback)),
+      THREADS_NUMBER_(threads_number),
+      current_(0),
+      credit_(0),
+      idle_threads_(0),
+      timer_waiter_(false),
+      timers_(0)
+  {}
+
+  void
+  SharedExecutor::ExecutorJob::work() noexcept
+  {
+    static const char* FUN = "SharedExecutor::ExecutorJob::work()";
+
+    Source* source = 0;
+
+    try
+    {
+      for(;;)
+      {
+        {
+          Mutex::WriteGuard guard(lock_);
+
+          if(source)
+          {
+            unit_finished_(source);
+            source = 0;
+          }
+
+          while(!is_terminating() && !(source = next_unit_()))
+          {
+            wait_();
+          }
+
+          if(!source)
+          {
+            break;
+          }
+
+          if(timers_ && !timer_waiter_ && idle_threads_)
+          {
+            // this thread could be the timer waiter, hand the timer over
+            work_.signal();
+          }
+        }
+
+        source->execute_unit();
+      }
+    }
+    catch (const Gears::Exception& ex)
+    {
+      if(source)
+      {
+        Mutex::WriteGuard guard(lock_);
+        unit_finished_(source);
+      }
+
+      ErrorStream ostr;
+      ostr << FUN << ": Gears::Exception: " << ex.what();
+      callback()->report_error(
+        ActiveObjectCallback::CRITICAL_ERROR,
+        ostr.str());
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::terminate() noexcept
+  {
+    Mutex::WriteGuard guard(lock_);
+    work_.broadcast();
+    timer_.broadcast();
+  }
+
+  void
+  SharedExecutor::ExecutorJob::attach(Source* source) noexcept
+  {
+    Mutex::WriteGuard guard(lock_);
+
+    if(source->attached_)
+    {
+      return;
+    }
+
+    source->attached_ = true;
+    sources_.push_back(source);
+
+    if(source->pending_)
+    {
+      link_(source);
+      wake_(source->pending_);
+    }
+
+    if(source->timer_set_)
+    {
+      if(!timers_++ || source->timer_ < nearest_timer_)
+      {
+        nearest_timer_ = source->timer_;
+      }
+
+      wake_timer_();
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::detach(Source* source) noexcept
+  {
+    Mutex::WriteGuard guard(lock_);
+
+    if(!source->attached_)
+    {
+      return;
+    }
+
+    source->attached_ = false;
+    sources_.erase(std::find(sources_.begin(), sources_.end(), source));
+
+    if(source->next_)
+    {
+      unlink_(source);
+    }
+
+    if(source->timer_set_)
+    {
+      --timers_;
+    }
+
+    if(!source->executing_)
+    {
+      detached_.broadcast();
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::wait_detached(Source* source)
+    /*throw(Gears::Exception)*/
+  {
+    Mutex::WriteGuard guard(lock_);
+
+    while(source->attached_ || source->executing_)
+    {
+      detached_.wait(lock_.mutex_i());
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::post(Source* source, unsigned long units)
+    noexcept
+  {
+    if(!units)
+    {
+      return;
+    }
+
+    Mutex::WriteGuard guard(lock_);
+    add_units_(source, units);
+  }
+
+  void
+  SharedExecutor::ExecutorJob::set_timer(Source* source, const Time* time)
+    noexcept
+  {
+    Mutex::WriteGuard guard(lock_);
+
+    if(!time)
+    {
+      if(source->timer_set_)
+      {
+        source->timer_set_ = false;
+        if(source->attached_)
+        {
+          --timers_;
+        }
+      }
+
+      return;
+    }
+
+    const bool was_set = source->timer_set_;
+    source->timer_set_ = true;
+    source->timer_ = *time;
+
+    if(source->attached_)
+    {
+      if(!was_set)
+      {
+        ++timers_;
+      }
+
+      if(timers_ == 1 || *time < nearest_timer_)
+      {
+        nearest_timer_ = *time;
+        wake_timer_();
+      }
+    }
+  }
+
+  unsigned long
+  SharedExecutor::ExecutorJob::thread_count() const noexcept
+  {
+    return THREADS_NUMBER_;
+  }
+
+  void
+  SharedExecutor::ExecutorJob::add_units_(Source* source, unsigned long units)
+    noexcept
+  {
+    source->pending_ += units;
+
+    if(source->attached_)
+    {
+      if(!source->next_)
+      {
+        link_(source);
+      }
+
+      wake_(units);
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::link_(Source* source) noexcept
+  {
+    // new source is put at the end of the round
+    if(current_)
+    {
+      source->next_ = current_;
+      source->prev_ = current_->prev_;
+      current_->prev_->next_ = source;
+      current_->prev_ = source;
+    }
+    else
+    {
+      source->next_ = source;
+      source->prev_ = source;
+      current_ = source;
+      credit_ = 0;
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::unlink_(Source* source) noexcept
+  {
+    if(current_ == source)
+    {
+      current_ = source->next_ != source ? source->next_ : 0;
+      credit_ = 0;
+    }
+
+    source->prev_->next_ = source->next_;
+    source->next_->prev_ = source->prev_;
+    source->next_ = 0;
+    source->prev_ = 0;
+  }
+
+  void
+  SharedExecutor::ExecutorJob::wake_(unsigned long units) noexcept
+  {
+    if(idle_threads_)
+    {
+      for(unsigned long i = std::min(units, idle_threads_); i; --i)
+      {
+        work_.signal();
+      }
+    }
+    else if(timer_waiter_)
+    {
+      timer_.signal();
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::wake_timer_() noexcept
+  {
+    if(timer_waiter_)
+    {
+      timer_.signal();
+    }
+    else if(idle_threads_)
+    {
+      work_.signal();
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::fire_timers_(const Time& now) noexcept
+  {
+    unsigned long timers = 0;
+
+    for(auto it = sources_.begin(); it != sources_.end(); ++it)
+    {
+      Source* const source = *it;
+
+      if(source->timer_set_)
+      {
+        if(source->timer_ <= now)
+        {
+          source->timer_set_ = false;
+
+          if(!source->SERIAL_ || !source->pending_)
+          {
+            add_units_(source, 1);
+          }
+        }
+        else if(!timers++ || source->timer_ < nearest_timer_)
+        {
+          nearest_timer_ = source->timer_;
+        }
+      }
+    }
+
+    timers_ = timers;
+  }
+
+  SharedExecutor::Source*
+  SharedExecutor::ExecutorJob::next_unit_() noexcept
+  {
+    if(timers_)
+    {
+      const Time now = Time::get_time_of_day();
+
+      if(now >= nearest_timer_)
+      {
+        fire_timers_(now);
+      }
+    }
+
+    if(!current_)
+    {
+      return 0;
+    }
+
+    Source* source = current_;
+
+    do
+    {
+      if(!source->SERIAL_ || !source->executing_)
+      {
+        if(current_ != source || !credit_)
+        {
+          current_ = source;
+          credit_ = source->WEIGHT_;
+        }
+
+        ++source->executing_;
+
+        if(!--source->pending_)
+        {
+          unlink_(source);
+        }
+        else if(!--credit_)
+        {
+          current_ = source->next_;
+        }
+
+        return source;
+      }
+
+      // busy serial source loses the rest of its turn
+      source = source->next_;
+    }
+    while(source != current_);
+
+    return 0;
+  }
+
+  void
+  SharedExecutor::ExecutorJob::unit_finished_(Source* source) noexcept
+  {
+    --source->executing_;
+
+    if(!source->attached_)
+    {
+      if(!source->executing_)
+      {
+        detached_.broadcast();
+      }
+    }
+    else if(source->SERIAL_ && source->next_)
+    {
+      // pending unit was skipped while this one was executing
+      wake_(1);
+    }
+  }
+
+  void
+  SharedExecutor::ExecutorJob::wait_() /*throw(Gears::Exception)*/
+  {
+    if(timers_ && !timer_waiter_)
+    {
+      const Time time(nearest_timer_);
+      timer_waiter_ = true;
+
+      try
+      {
+        timer_.timed_wait(lock_.mutex_i(), &time);
+      }
+      catch (...)
+      {
+        timer_waiter_ = false;
+        throw;
+      }
+
+      timer_waiter_ = false;
+      return;
+    }
+
+    ++idle_threads_;
+
+    try
+    {
+      work_.wait(lock_.mutex_i());
+    }
+    catch (...)
+    {
+      --idle_threads_;
+      throw;
+    }
+
+    --idle_threads_;
+  }
+
+  //
+  // SharedExecutor class
+  //
+
+  SharedExecutor::SharedExecutor(
+    ActiveObjectCallback_var callback,
+    unsigned int threads_number,
+    const ThreadRunner::Options& thread_options)
+    /*throw(InvalidArgument, Exception, Gears::Exception)*/
+    : ActiveObjectCommonImpl(
+        ExecutorJob_var(new ExecutorJob(
+          std::move(callback),
+          threads_(threads_number))),
+        threads_(threads_number),
+        thread_options),
+      job_(static_cast<ExecutorJob&>(*SINGLE_JOB_))
+  {}
+
+  SharedExecutor::~SharedExecutor() noexcept
+  {}
+
+  unsigned int
+  SharedExecutor::threads_(unsigned int threads_number) noexcept
+  {
+    if(threads_number)
+    {
+      return threads_number;
+    }
+
+    return std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  void
+  SharedExecutor::attach(Source* source) noexcept
+  {
+    job_.attach(source);
+  }
+
+  void
+  SharedExecutor::detach(Source* source) noexcept
+  {
+    job_.detach(source);
+  }
+
+  void
+  SharedExecutor::wait_detached(Source* source) /*throw(Gears::Exception)*/
+  {
+    job_.wait_detached(source);
+  }
+
+  void
+  SharedExecutor::post(Source* source, unsigned long units) noexcept
+  {
+    job_.post(source, units);
+  }
+
+  void
+  SharedExecutor::set_timer(Source* source, const Time* time) noexcept
+  {
+    job_.set_timer(source, time);
+  }
+
+  unsigned long
+  SharedExecutor::thread_count() const noexcept
+  {
+    return job_.thread_count();
+  }
+}
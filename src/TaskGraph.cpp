@@ -0,0 +1,353 @@
+#include <exception>
+
+#include <gears/TaskGraph.hpp>
+
+namespace Gears
+{
+  //
+  // TaskGraph class
+  //
+
+  TaskGraph::TaskGraph() noexcept
+    : task_runner_(0),
+      remaining_(0),
+      failed_(0),
+      completed_(true)
+  {}
+
+  TaskGraph::~TaskGraph() noexcept
+  {
+    try
+    {
+      wait();
+    }
+    catch (...)
+    {}
+  }
+
+  void
+  TaskGraph::check_not_submitted_(const char* fun) const
+    /*throw(AlreadySubmitted)*/
+  {
+    if (!completed_.load(std::memory_order_acquire))
+    {
+      ErrorStream ostr;
+      ostr << fun << ": graph is executed";
+      throw AlreadySubmitted(ostr.str());
+    }
+  }
+
+  TaskGraph::NodeId
+  TaskGraph::add_task(InlineTask task)
+    /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/
+  {
+    static const char* FUN = "TaskGraph::add_task()";
+
+    check_not_submitted_(FUN);
+
+    if (!task)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    nodes_.emplace_back(std::move(task));
+    return nodes_.size() - 1;
+  }
+
+  TaskGraph::NodeId
+  TaskGraph::add_task(Task_var task)
+    /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/
+  {
+    static const char* FUN = "TaskGraph::add_task()";
+
+    check_not_submitted_(FUN);
+
+    if (!task)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    return add_task(InlineTask([task]() { task->execute(); }));
+  }
+
+  void
+  TaskGraph::add_dependency(NodeId task, NodeId dependency)
+    /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/
+  {
+    static const char* FUN = "TaskGraph::add_dependency()";
+
+    check_not_submitted_(FUN);
+
+    if (task >= nodes_.size() || dependency >= nodes_.size() ||
+        task == dependency)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": invalid dependency " << task << " on " << dependency;
+      throw InvalidArgument(ostr.str());
+    }
+
+    nodes_[dependency].successors.push_back(task);
+    ++nodes_[task].dependencies;
+  }
+
+  void
+  TaskGraph::submit(TaskRunner* task_runner)
+    /*throw(InvalidArgument, AlreadySubmitted, Gears::Exception)*/
+  {
+    static const char* FUN = "TaskGraph::submit()";
+
+    check_not_submitted_(FUN);
+
+    if (!task_runner)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": task runner is NULL";
+      throw InvalidArgument(ostr.str());
+    }
+
+    // check the graph is acyclic: topological sort of dependency counters
+    std::vector<unsigned long> dependencies(nodes_.size());
+    std::vector<NodeId> roots;
+    std::vector<NodeId> sorted;
+    sorted.reserve(nodes_.size());
+
+    for (NodeId id = 0; id < nodes_.size(); ++id)
+    {
+      dependencies[id] = nodes_[id].dependencies;
+      if (!dependencies[id])
+      {
+        roots.push_back(id);
+        sorted.push_back(id);
+      }
+    }
+
+    for (unsigned long i = 0; i < sorted.size(); ++i)
+    {
+      const Node& node = nodes_[sorted[i]];
+      for (auto it = node.successors.begin(); it != node.successors.end(); ++it)
+      {
+        if (!--dependencies[*it])
+        {
+          sorted.push_back(*it);
+        }
+      }
+    }
+
+    if (sorted.size() != nodes_.size())
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": graph has a cycle";
+      throw InvalidArgument(ostr.str());
+    }
+
+    if (nodes_.empty())
+    {
+      return;
+    }
+
+    for (auto it = nodes_.begin(); it != nodes_.end(); ++it)
+    {
+      it->pending.store(it->dependencies, std::memory_order_relaxed);
+      it->skipped.store(false, std::memory_order_relaxed);
+      it->enqueue_state.store(ES_NONE, std::memory_order_relaxed);
+    }
+
+    task_runner_ = task_runner;
+    failed_.store(0, std::memory_order_relaxed);
+    remaining_.store(nodes_.size(), std::memory_order_relaxed);
+    completed_.store(false, std::memory_order_release);
+
+    // tasks rejected by the runner are executed here, their exception
+    // is rethrown after all roots are submitted
+    std::exception_ptr error;
+
+    for (auto it = roots.begin(); it != roots.end(); ++it)
+    {
+      if (!enqueue_node_(*it))
+      {
+        try
+        {
+          run_node_(*it);
+        }
+        catch (...)
+        {
+          if (!error)
+          {
+            error = std::current_exception();
+          }
+        }
+      }
+    }
+
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  bool
+  TaskGraph::wait(const Time* timeout, bool time_is_relative)
+    /*throw(Gears::Exception)*/
+  {
+    const Time end_time(
+      timeout && time_is_relative ?
+      Time::get_time_of_day() + *timeout :
+      (timeout ? *timeout : Time::ZERO));
+
+    Condition::Guard guard(done_);
+
+    while (!completed_.load(std::memory_order_acquire))
+    {
+      if (!guard.timed_wait(timeout ? &end_time : 0))
+      {
+        return completed_.load(std::memory_order_acquire);
+      }
+    }
+
+    return true;
+  }
+
+  void
+  TaskGraph::run_node_(NodeId id) /*throw(Gears::Exception)*/
+  {
+    std::exception_ptr error;
+    // released tasks that should be finished in this thread
+    std::vector<NodeId> inline_nodes;
+    unsigned long finished = 0;
+
+    for (;;)
+    {
+      Node& node = nodes_[id];
+      bool success = !node.skipped.load(std::memory_order_relaxed);
+
+      if (success)
+      {
+        try
+        {
+          node.task();
+        }
+        catch (...)
+        {
+          if (!error)
+          {
+            error = std::current_exception();
+          }
+          success = false;
+        }
+      }
+
+      if (!success)
+      {
+        failed_.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      for (auto it = node.successors.begin(); it != node.successors.end();
+           ++it)
+      {
+        Node& successor = nodes_[*it];
+
+        if (!success)
+        {
+          // ordered before the releasing decrement
+          successor.skipped.store(true, std::memory_order_relaxed);
+        }
+
+        if (successor.pending.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+            (successor.skipped.load(std::memory_order_relaxed) ||
+             !enqueue_node_(*it)))
+        {
+          inline_nodes.push_back(*it);
+        }
+      }
+
+      ++finished;
+
+      if (inline_nodes.empty())
+      {
+        break;
+      }
+
+      id = inline_nodes.back();
+      inline_nodes.pop_back();
+    }
+
+    // the graph can be destroyed after this call
+    nodes_finished_(finished);
+
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  bool
+  TaskGraph::enqueue_node_(NodeId id) noexcept
+  {
+    Node& node = nodes_[id];
+
+    // the rejected task is destroyed inside enqueue_task(),
+    // node_dropped_ leaves it to this call
+    node.enqueue_state.store(ES_ENQUEUING, std::memory_order_relaxed);
+
+    try
+    {
+      task_runner_->enqueue_task(InlineTask(NodeCall(this, id)));
+    }
+    catch (...)
+    {
+      // the caller executes the task, so the run is always finished
+      node.enqueue_state.store(ES_NONE, std::memory_order_relaxed);
+      return false;
+    }
+
+    if (node.enqueue_state.exchange(ES_NONE, std::memory_order_acq_rel) ==
+        ES_DROPPED)
+    {
+      // dropped by clear() before the return, the caller finishes it
+      node.skipped.store(true, std::memory_order_relaxed);
+      return false;
+    }
+
+    return true;
+  }
+
+  void
+  TaskGraph::node_dropped_(NodeId id) noexcept
+  {
+    Node& node = nodes_[id];
+
+    if (node.enqueue_state.exchange(ES_DROPPED, std::memory_order_acq_rel) ==
+        ES_ENQUEUING)
+    {
+      // enqueue_node_ finishes the task
+      return;
+    }
+
+    node.skipped.store(true, std::memory_order_relaxed);
+
+    try
+    {
+      // the skipped task isn't executed, successors are skipped
+      run_node_(id);
+    }
+    catch (...)
+    {}
+  }
+
+  void
+  TaskGraph::nodes_finished_(unsigned long count) noexcept
+  {
+    if (remaining_.fetch_sub(count, std::memory_order_acq_rel) == count)
+    {
+      // waiter returns only after the flag is set under the lock,
+      // so the graph isn't destroyed while it is accessed here
+      Condition::Guard guard(done_);
+      completed_.store(true, std::memory_order_release);
+      done_.broadcast();
+    }
+  }
+}
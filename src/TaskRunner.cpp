@@ -1,185 +1,1376 @@
 #include <cassert>
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
 
+#include <gears/MPMCQueue.hpp>
 #include <gears/TaskRunner.hpp>
 
 namespace Gears
 {
+  //
+  // TaskLatch class
+  //
+
+  bool
+  TaskLatch::wait(const Time* timeout, bool time_is_relative)
+    /*throw(Gears::Exception)*/
+  {
+    const Time end_time(
+      timeout && time_is_relative ?
+      Time::get_time_of_day() + *timeout :
+      (timeout ? *timeout : Time::ZERO));
+
+    Condition::Guard guard(cond_);
+
+    while(count_.load(std::memory_order_acquire))
+    {
+      if(!guard.timed_wait(timeout ? &end_time : 0))
+      {
+        return count_.load(std::memory_order_acquire) == 0;
+      }
+    }
+
+    return true;
+  }
+
+  void
+  TaskLatch::count_down_(unsigned long count) noexcept
+  {
+    if(count_.fetch_sub(count, std::memory_order_acq_rel) == count)
+    {
+      TaskLatch_var self;
+
+      {
+        Condition::Guard guard(cond_);
+        self.swap(self_);
+        cond_.broadcast();
+      }
+
+      // self can be the last reference, the latch is destroyed here
+    }
+  }
+
+  //
+  // TaskRunner::LockedTaskQueue class
+  //
+
+  class TaskRunner::LockedTaskQueue: public TaskRunner::TaskQueue
+  {
+  public:
+    virtual unsigned long
+    push(QueuedTask* tasks, unsigned long count) /*throw(Gears::Exception)*/
+    {
+      SyncPolicy::WriteGuard guard(lock_);
+      tasks_.insert(
+        tasks_.end(),
+        std::make_move_iterator(tasks),
+        std::make_move_iterator(tasks + count));
+      return count;
+    }
+
+    virtual bool
+    pop(QueuedTask& task) noexcept
+    {
+      SyncPolicy::WriteGuard guard(lock_);
+      if(tasks_.empty())
+      {
+        return false;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      return true;
+    }
+
+    virtual unsigned long
+    size() noexcept
+    {
+      SyncPolicy::ReadGuard guard(lock_);
+      return tasks_.size();
+    }
+
+    virtual unsigned long
+    clear(QueuedTaskList& tasks) /*throw(Gears::Exception)*/
+    {
+      {
+        SyncPolicy::WriteGuard guard(lock_);
+        tasks.swap(tasks_);
+      }
+      return tasks.size();
+    }
+
+  private:
+    typedef Gears::Mutex SyncPolicy;
+
+    SyncPolicy lock_;
+    QueuedTaskList tasks_;
+  };
+
+  //
+  // TaskRunner::LockFreeTaskQueue class
+  //
+
+  class TaskRunner::LockFreeTaskQueue: public TaskRunner::TaskQueue
+  {
+  public:
+    explicit
+    LockFreeTaskQueue(unsigned long capacity) /*throw(Gears::Exception)*/
+      : tasks_(capacity)
+    {}
+
+    virtual unsigned long
+    push(QueuedTask* tasks, unsigned long count) noexcept
+    {
+      unsigned long pushed = 0;
+      while(pushed < count && tasks_.push(tasks[pushed]))
+      {
+        ++pushed;
+      }
+      return pushed;
+    }
+
+    virtual bool
+    pop(QueuedTask& task) noexcept
+    {
+      return tasks_.pop(task);
+    }
+
+    virtual unsigned long
+    size() noexcept
+    {
+      return tasks_.size();
+    }
+
+    virtual unsigned long
+    clear(QueuedTaskList& tasks) /*throw(Gears::Exception)*/
+    {
+      unsigned long removed = 0;
+      QueuedTask task;
+      while(tasks_.pop(task))
+      {
+        tasks.emplace_back(std::move(task));
+        ++removed;
+      }
+      return removed;
+    }
+
+  private:
+    MPMCQueue<QueuedTask> tasks_;
+  };
+
+  //
+  // TaskRunner::WorkStealingTaskQueue class
+  //
+
+  class TaskRunner::WorkStealingTaskQueue: public TaskRunner::TaskQueue
+  {
+  public:
+    explicit
+    WorkStealingTaskQueue(unsigned long number_of_workers)
+      /*throw(Gears::Exception)*/
+      : NUMBER_OF_WORKERS_(number_of_workers),
+        workers_(new WorkerQueue[number_of_workers]),
+        size_(0)
+    {}
+
+    virtual unsigned long
+    push(QueuedTask* tasks, unsigned long count) /*throw(Gears::Exception)*/
+    {
+      // tasks produced by own working thread stay in its deque
+      WorkerQueue& queue = current_.owner == this ?
+        workers_[current_.index] : shared_;
+
+      {
+        SyncPolicy::WriteGuard guard(queue.lock);
+        queue.tasks.insert(
+          queue.tasks.end(),
+          std::make_move_iterator(tasks),
+          std::make_move_iterator(tasks + count));
+      }
+
+      size_.fetch_add(count, std::memory_order_relaxed);
+      return count;
+    }
+
+    virtual bool
+    pop(QueuedTask& task) noexcept
+    {
+      const unsigned long own = current_.owner == this ?
+        current_.index : NUMBER_OF_WORKERS_;
+
+      if(own < NUMBER_OF_WORKERS_ && pop_back_(workers_[own], task))
+      {
+        return true;
+      }
+
+      // a scan can miss a task pushed into an already visited deque,
+      // repeat it while the queue isn't empty
+      do
+      {
+        if(pop_front_(shared_, task))
+        {
+          return true;
+        }
+
+        for(unsigned long i = 1; i <= NUMBER_OF_WORKERS_; ++i)
+        {
+          if(pop_front_(workers_[(own + i) % NUMBER_OF_WORKERS_], task))
+          {
+            return true;
+          }
+        }
+      }
+      while(size_.load(std::memory_order_relaxed));
+
+      return false;
+    }
+
+    virtual unsigned long
+    size() noexcept
+    {
+      return size_.load(std::memory_order_relaxed);
+    }
+
+    virtual unsigned long
+    clear(QueuedTaskList& tasks) /*throw(Gears::Exception)*/
+    {
+      unsigned long removed = clear_(shared_, tasks);
+      for(unsigned long i = 0; i < NUMBER_OF_WORKERS_; ++i)
+      {
+        removed += clear_(workers_[i], tasks);
+      }
+      return removed;
+    }
+
+    virtual void
+    worker_started() noexcept
+    {
+      for(unsigned long i = 0; i < NUMBER_OF_WORKERS_; ++i)
+      {
+        bool used = false;
+        if(workers_[i].used.compare_exchange_strong(used, true))
+        {
+          current_.owner = this;
+          current_.index = i;
+          return;
+        }
+      }
+    }
+
+    virtual void
+    worker_stopped() noexcept
+    {
+      if(current_.owner == this)
+      {
+        // tasks left in the deque are stolen by remaining workers
+        workers_[current_.index].used.store(false);
+        current_.owner = 0;
+      }
+    }
+
+  private:
+    typedef Gears::Mutex SyncPolicy;
+
+    struct alignas(64) WorkerQueue
+    {
+      WorkerQueue() noexcept
+        : used(false)
+      {}
+
+      SyncPolicy lock;
+      QueuedTaskList tasks;
+      std::atomic<bool> used;
+    };
+
+    struct CurrentWorker
+    {
+      const WorkStealingTaskQueue* owner;
+      unsigned long index;
+    };
+
+    bool
+    pop_back_(WorkerQueue& queue, QueuedTask& task) noexcept
+    {
+      SyncPolicy::WriteGuard guard(queue.lock);
+      if(queue.tasks.empty())
+      {
+        return false;
+      }
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    bool
+    pop_front_(WorkerQueue& queue, QueuedTask& task) noexcept
+    {
+      SyncPolicy::WriteGuard guard(queue.lock);
+      if(queue.tasks.empty())
+      {
+        return false;
+      }
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    unsigned long
+    clear_(WorkerQueue& queue, QueuedTaskList& tasks)
+      /*throw(Gears::Exception)*/
+    {
+      QueuedTaskList queue_tasks;
+      {
+        SyncPolicy::WriteGuard guard(queue.lock);
+        queue_tasks.swap(queue.tasks);
+        size_.fetch_sub(queue_tasks.size(), std::memory_order_relaxed);
+      }
+      tasks.insert(
+        tasks.end(),
+        std::make_move_iterator(queue_tasks.begin()),
+        std::make_move_iterator(queue_tasks.end()));
+      return queue_tasks.size();
+    }
+
+  private:
+    static thread_local CurrentWorker current_;
+
+    const unsigned long NUMBER_OF_WORKERS_;
+    WorkerQueue shared_;
+    std::unique_ptr<WorkerQueue[]> workers_;
+    std::atomic<unsigned long> size_;
+  };
+
+  thread_local TaskRunner::WorkStealingTaskQueue::CurrentWorker
+    TaskRunner::WorkStealingTaskQueue::current_ = { 0, 0 };
+
+  //
+  // TaskRunner::LaneTaskQueue class
+  //
+
+  class TaskRunner::LaneTaskQueue: public TaskRunner::TaskQueue
+  {
+  public:
+    LaneTaskQueue(const LaneArray& lanes, LanePolicy lane_policy)
+      /*throw(Gears::Exception)*/
+      : LANE_POLICY_(lane_policy),
+        lanes_(lanes.size()),
+        current_lane_(0),
+        credit_(0),
+        size_(0)
+    {
+      for(unsigned long i = 0; i < lanes.size(); ++i)
+      {
+        lanes_[i].max_pending_tasks = lanes[i].max_pending_tasks;
+        lanes_[i].weight = std::max<unsigned long>(lanes[i].weight, 1);
+      }
+
+      credit_ = lanes_[0].weight;
+    }
+
+    virtual unsigned long
+    push(QueuedTask* tasks, unsigned long count)
+      /*throw(InvalidArgument, Gears::Exception)*/
+    {
+      static const char* FUN = "TaskRunner::LaneTaskQueue::push()";
+
+      const unsigned long lane = tasks[0].lane;
+
+      for(unsigned long i = 0; i < count; ++i)
+      {
+        if(tasks[i].lane >= lanes_.size() || tasks[i].lane != lane)
+        {
+          ErrorStream ostr;
+          ostr << FUN << ": invalid lane " << tasks[i].lane;
+          throw InvalidArgument(ostr.str());
+        }
+      }
+
+      LaneQueue& lane_queue = lanes_[lane];
+
+      SyncPolicy::WriteGuard guard(lock_);
+
+      // batch is accepted by the lane entirely or rejected
+      if(lane_queue.max_pending_tasks &&
+         lane_queue.tasks.size() + count > lane_queue.max_pending_tasks)
+      {
+        return 0;
+      }
+
+      lane_queue.tasks.insert(
+        lane_queue.tasks.end(),
+        std::make_move_iterator(tasks),
+        std::make_move_iterator(tasks + count));
+      size_.fetch_add(count, std::memory_order_relaxed);
+      return count;
+    }
+
+    virtual bool
+    pop(QueuedTask& task) noexcept
+    {
+      SyncPolicy::WriteGuard guard(lock_);
+
+      if(!size_.load(std::memory_order_relaxed))
+      {
+        return false;
+      }
+
+      LaneQueue* lane_queue = 0;
+
+      if(LANE_POLICY_ == LP_STRICT)
+      {
+        for(auto it = lanes_.begin(); it != lanes_.end(); ++it)
+        {
+          if(!it->tasks.empty())
+          {
+            lane_queue = &*it;
+            break;
+          }
+        }
+      }
+      else
+      {
+        // lane keeps the turn while it has tasks and credit
+        while(lanes_[current_lane_].tasks.empty() || !credit_)
+        {
+          current_lane_ = (current_lane_ + 1) % lanes_.size();
+          credit_ = lanes_[current_lane_].weight;
+        }
+
+        lane_queue = &lanes_[current_lane_];
+        --credit_;
+      }
+
+      task = std::move(lane_queue->tasks.front());
+      lane_queue->tasks.pop_front();
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    virtual unsigned long
+    size() noexcept
+    {
+      return size_.load(std::memory_order_relaxed);
+    }
+
+    virtual unsigned long
+    clear(QueuedTaskList& tasks) /*throw(Gears::Exception)*/
+    {
+      SyncPolicy::WriteGuard guard(lock_);
+
+      for(auto it = lanes_.begin(); it != lanes_.end(); ++it)
+      {
+        tasks.insert(
+          tasks.end(),
+          std::make_move_iterator(it->tasks.begin()),
+          std::make_move_iterator(it->tasks.end()));
+        it->tasks.clear();
+      }
+
+      size_.store(0, std::memory_order_relaxed);
+      return tasks.size();
+    }
+
+  private:
+    typedef Gears::Mutex SyncPolicy;
+
+    struct LaneQueue
+    {
+      unsigned long max_pending_tasks;
+      unsigned long weight;
+      QueuedTaskList tasks;
+    };
+
+    typedef std::vector<LaneQueue> LaneQueueArray;
+
+  private:
+    const LanePolicy LANE_POLICY_;
+
+    SyncPolicy lock_;
+    LaneQueueArray lanes_;
+    unsigned long current_lane_;
+    unsigned long credit_;
+    std::atomic<unsigned long> size_;
+  };
+
+  //
+  // TaskRunner::TaskRunnerJob::WorkerStats class
+  //
+
+  /**
+   * Statistics buckets of one working thread
+   */
+  struct alignas(64) TaskRunner::TaskRunnerJob::WorkerStats
+  {
+    WorkerStats() noexcept
+      : used(false)
+    {}
+
+    std::atomic<bool> used;
+    DurationRecorder queue_wait;
+    DurationRecorder execution;
+  };
+
   //
   // TaskRunner::TaskRunnerJob class
   //
 
-  TaskRunner::TaskRunnerJob::TaskRunnerJob(
-    ActiveObjectCallback_var callback,
-    unsigned long number_of_threads,
-    unsigned long max_pending_tasks)
+  TaskRunner::TaskRunnerJob::TaskRunnerJob(
+    ActiveObjectCallback_var callback,
+    const ElasticOptions& elastic_options,
+    unsigned long max_pending_tasks,
+    TaskQueue_var tasks,
+    SharedExecutor_var executor,
+    unsigned long weight)
+    /*throw(InvalidArgument, Gears::Exception)*/
+    : SingleJob(std::move(callback)),
+      SharedExecutor::Source(weight, false),
+      NUMBER_OF_THREADS_(elastic_options.max_threads),
+      MIN_THREADS_(elastic_options.min_threads),
+      ELASTIC_(elastic_options.min_threads != elastic_options.max_threads),
+      GROW_QUEUE_DEPTH_(std::max<unsigned long>(
+        elastic_options.grow_queue_depth, 1)),
+      GROW_WAIT_TIME_(elastic_options.grow_wait_time),
+      IDLE_TIMEOUT_(elastic_options.idle_timeout),
+      tasks_(std::move(tasks)),
+      new_task_(0),
+      not_full_(static_cast<int>(std::min<unsigned long>(max_pending_tasks, SEM_VALUE_MAX))),
+      LIMITED_(max_pending_tasks),
+      worker_stats_(new WorkerStats[elastic_options.max_threads]),
+      overflows_(0),
+      enqueue_waits_(0),
+      expired_(0),
+      cancelled_(0),
+      max_queue_depth_(0),
+      thread_runner_(0),
+      thread_count_(0),
+      growing_(false),
+      executor_(std::move(executor))
+  {
+    static const char* FUN = "TaskRunner::TaskRunnerJob::TaskRunnerJob()";
+
+    if(!elastic_options.min_threads ||
+       elastic_options.min_threads > elastic_options.max_threads)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": invalid threads range [" <<
+        elastic_options.min_threads << ", " <<
+        elastic_options.max_threads << "]";
+      throw InvalidArgument(ostr.str());
+    }
+  }
+
+  TaskRunner::TaskRunnerJob::~TaskRunnerJob() noexcept
+  {
+    if(executor_)
+    {
+      // executor threads can still execute tasks of a runner
+      // destroyed without deactivation
+      executor_->detach(this);
+
+      try
+      {
+        executor_->wait_detached(this);
+      }
+      catch (...)
+      {}
+    }
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::clear() /*throw(Gears::Exception)*/
+  {
+    QueuedTaskList dropped;
+    const unsigned long removed = tasks_->clear(dropped);
+
+    for(unsigned long i = removed; i; i--)
+    {
+      // worker that already took the wakeup will find the queue empty
+      new_task_.try_acquire();
+      if(LIMITED_)
+      {
+        not_full_.release();
+      }
+    }
+
+    for(auto it = dropped.begin(); it != dropped.end(); ++it)
+    {
+      if(it->latch)
+      {
+        it->latch->count_down_(1);
+      }
+    }
+
+    tasks_finished_(removed);
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::enqueue_task(
+    InlineTask task,
+    unsigned long lane,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    QueuedTask queued_task(std::move(task), lane);
+    enqueue_tasks(&queued_task, 1, timeout);
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::enqueue_task(
+    QueuedTask& task,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    enqueue_tasks(&task, 1, timeout);
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::enqueue_tasks(
+    QueuedTask* tasks,
+    unsigned long count,
+    const Time* timeout)
+    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  {
+    static const char* FUN = "TaskRunner::TaskRunnerJob::enqueue_tasks()";
+
+    if(!count)
+    {
+      return;
+    }
+
+    for(unsigned long i = 0; i < count; ++i)
+    {
+      if(!tasks[i].task)
+      {
+        drop_tasks_(tasks, count);
+
+        ErrorStream ostr;
+        ostr << FUN << ": task is NULL";
+        throw InvalidArgument(ostr.str());
+      }
+    }
+
+    // Producer: reserve room for the whole batch
+    if(LIMITED_)
+    {
+      if(!reserve_(count, timeout))
+      {
+        drop_tasks_(tasks, count);
+        overflow_(count);
+
+        ErrorStream ostr;
+        ostr << FUN << ": TaskRunner overflow";
+        throw Overflow(ostr.str());
+      }
+    }
+
+    const Time now = Time::get_time_of_day();
+    for(unsigned long i = 0; i < count; ++i)
+    {
+      tasks[i].enqueue_time = now;
+    }
+
+    // account tasks before they become visible to working threads
+    unfinished_tasks_.fetch_add(count, std::memory_order_relaxed);
+
+    unsigned long pushed;
+
+    try
+    {
+      pushed = tasks_->push(tasks, count);
+    }
+    catch (...)
+    {
+      if(LIMITED_)
+      {
+        not_full_.release(static_cast<int>(count));
+      }
+      drop_tasks_(tasks, count);
+      tasks_finished_(count);
+      throw;
+    }
+
+    // Wake working threads, one per task
+    if(pushed)
+    {
+      new_task_.release(static_cast<int>(pushed));
+
+      if(executor_)
+      {
+        executor_->post(this, pushed);
+      }
+
+      // positive counter is the number of tasks without free thread
+      const int depth = new_task_.value();
+
+      if(depth > 0)
+      {
+        unsigned long max_depth =
+          max_queue_depth_.load(std::memory_order_relaxed);
+
+        while(static_cast<unsigned long>(depth) > max_depth &&
+          !max_queue_depth_.compare_exchange_weak(
+            max_depth, depth, std::memory_order_relaxed))
+        {}
+      }
+
+      if(ELASTIC_ &&
+         depth >= static_cast<int>(
+           std::min<unsigned long>(GROW_QUEUE_DEPTH_, SEM_VALUE_MAX)))
+      {
+        grow_();
+      }
+    }
+
+    if(pushed != count)
+    {
+      if(LIMITED_)
+      {
+        not_full_.release(static_cast<int>(count - pushed));
+      }
+      drop_tasks_(tasks + pushed, count - pushed);
+      tasks_finished_(count - pushed);
+      overflow_(count - pushed);
+
+      ErrorStream ostr;
+      ostr << FUN << ": TaskRunner overflow";
+      throw Overflow(ostr.str());
+    }
+  }
+
+  bool
+  TaskRunner::TaskRunnerJob::reserve_(
+    unsigned long count,
+    const Time* timeout)
+    /*throw(Gears::Exception)*/
+  {
+    if(count > static_cast<unsigned long>(SEM_VALUE_MAX))
+    {
+      return false;
+    }
+
+    if(not_full_.try_acquire(static_cast<int>(count)))
+    {
+      return true;
+    }
+
+    if(!timeout)
+    {
+      return false;
+    }
+
+    enqueue_waits_.fetch_add(1, std::memory_order_relaxed);
+
+    // room is taken one by one as working threads free it,
+    // a partially reserved batch gives its room back on timeout
+    for(unsigned long i = 0; i < count; ++i)
+    {
+      if(!not_full_.timed_acquire(timeout))
+      {
+        if(i)
+        {
+          not_full_.release(static_cast<int>(i));
+        }
+
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool
+  TaskRunner::TaskRunnerJob::discard_(
+    const QueuedTask& task,
+    const Time& now)
+    noexcept
+  {
+    if(task.cancellation && task.cancellation->cancelled())
+    {
+      cancelled_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    if(task.deadline != Time::ZERO && now > task.deadline)
+    {
+      expired_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    return false;
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::drop_tasks_(
+    QueuedTask* tasks,
+    unsigned long count)
+    noexcept
+  {
+    for(unsigned long i = 0; i < count; ++i)
+    {
+      if(tasks[i].latch)
+      {
+        tasks[i].latch->count_down_(1);
+        tasks[i].latch = 0;
+      }
+    }
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::tasks_finished_(unsigned long count) noexcept
+  {
+    if(count &&
+       unfinished_tasks_.fetch_sub(count, std::memory_order_acq_rel) == count)
+    {
+      // notify under lock: waiter checks the counter holding it
+      Condition::Guard guard(idle_);
+      idle_.broadcast();
+    }
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::wait_for_queue_exhausting() /*throw(Gears::Exception)*/
+  {
+    // idle state wakes the waiter immediately, queue exhausting while
+    // tasks are still executing is checked periodically
+    const Time CHECK_PERIOD(0, 10000);
+
+    Condition::Guard guard(idle_);
+
+    while(tasks_->size() && unfinished_tasks_.load(std::memory_order_acquire))
+    {
+      guard.timed_wait(&CHECK_PERIOD, true);
+    }
+  }
+
+  bool
+  TaskRunner::TaskRunnerJob::wait_idle(
+    const Time* timeout,
+    bool time_is_relative)
     /*throw(Gears::Exception)*/
-    : SingleJob(std::move(callback)),
-      NUMBER_OF_THREADS_(number_of_threads),
-      new_task_(0),
-      not_full_(static_cast<int>(std::min<unsigned long>(max_pending_tasks, SEM_VALUE_MAX))),
-      LIMITED_(max_pending_tasks)
-  {}
+  {
+    const Time end_time(
+      timeout && time_is_relative ?
+      Time::get_time_of_day() + *timeout :
+      (timeout ? *timeout : Time::ZERO));
 
-  TaskRunner::TaskRunnerJob::~TaskRunnerJob() noexcept
-  {}
+    Condition::Guard guard(idle_);
+
+    while(unfinished_tasks_.load(std::memory_order_acquire))
+    {
+      if(!guard.timed_wait(timeout ? &end_time : 0))
+      {
+        return unfinished_tasks_.load(std::memory_order_acquire) == 0;
+      }
+    }
+
+    return true;
+  }
 
   void
-  TaskRunner::TaskRunnerJob::clear() /*throw(Gears::Exception)*/
+  TaskRunner::TaskRunnerJob::work() noexcept
   {
-    SyncPolicy::WriteGuard guard(mutex());
-    if(LIMITED_)
+    static const char* FUN = "TaskRunner::TaskRunnerJob::work()";
+
+    tasks_->worker_started();
+    WorkerStats* const stats = acquire_worker_stats_();
+
+    try
     {
-      for(size_t i = tasks_.size(); i; i--)
+      for(;;)
       {
-        not_full_.release();
+        QueuedTask task;
+
+        if(!wait_task_())
+        {
+          break;
+        }
+
+        if(!tasks_->pop(task))
+        {
+          // queue was cleared after the wakeup
+          continue;
+        }
+
+        execute_task_(task, stats);
       }
     }
-    tasks_.clear();
+    catch (const Gears::Exception& e)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": Gears::Exception: " << e.what();
+      callback()->report_error(
+        ActiveObjectCallback::CRITICAL_ERROR,
+        ostr.str());
+    }
+
+    if(stats)
+    {
+      stats->used.store(false, std::memory_order_release);
+    }
+
+    tasks_->worker_stopped();
   }
 
   void
-  TaskRunner::TaskRunnerJob::enqueue_task(
-    Task_var task,
-    const Time* /*timeout*/)
-    /*throw(InvalidArgument, Overflow, NotActive, Gears::Exception)*/
+  TaskRunner::TaskRunnerJob::execute_task_(
+    QueuedTask& task,
+    WorkerStats* stats)
+    noexcept
   {
-    static const char* FUN = "TaskRunner::TaskRunnerJob::enqueue_task()";
+    const Time start = Time::get_time_of_day();
+    const Time queue_wait = start - task.enqueue_time;
 
-    if(!task)
+    if(stats)
     {
-      ErrorStream ostr;
-      ostr << FUN << ": task is NULL";
-      throw InvalidArgument(ostr.str());
+      stats->queue_wait.add(queue_wait);
     }
 
-    // Producer
+    if(ELASTIC_ && GROW_WAIT_TIME_ != Time::ZERO &&
+       queue_wait >= GROW_WAIT_TIME_ &&
+       new_task_.value() > 0)
+    {
+      grow_();
+    }
+
+    // Tell any blocked thread that the queue is ready for a "new item"
     if(LIMITED_)
     {
-//    if(!(timeout ? not_full_.timed_acquire(timeout) :
-//      not_full_.try_acquire()))
-      if(not_full_.try_acquire())
-      {
-        ErrorStream ostr;
-        ostr << FUN << ": TaskRunner overflow";
-        throw Overflow(ostr.str());
-      }
+      not_full_.release();
     }
 
+    // stale tasks are dropped without execution
+    if(!discard_(task, start))
     {
-      SyncPolicy::WriteGuard guard(mutex());
       try
       {
-        tasks_.emplace_back(std::move(task));
+        task.task();
       }
-      catch (...)
+      catch (const Gears::Exception& ex)
       {
-        if(LIMITED_)
-        {
-          not_full_.release();
-        }
-        throw;
+        callback()->report_error(
+          ActiveObjectCallback::ERROR,
+          SubString(ex.what()));
+      }
+
+      if(stats)
+      {
+        stats->execution.add(Time::get_time_of_day() - start);
       }
     }
-    // Wake any working thread
-    new_task_.release();
+
+    task.task.reset();
+
+    if(task.latch)
+    {
+      task.latch->count_down_(1);
+    }
+
+    tasks_finished_(1);
   }
 
   void
-  TaskRunner::TaskRunnerJob::wait_for_queue_exhausting() /*throw(Gears::Exception)*/
+  TaskRunner::TaskRunnerJob::execute_unit() noexcept
+  {
+    QueuedTask task;
+
+    // unit of a task dropped by clear() finds no wakeup
+    if(!new_task_.try_acquire() || !tasks_->pop(task))
+    {
+      return;
+    }
+
+    WorkerStats* const stats = acquire_worker_stats_();
+
+    execute_task_(task, stats);
+
+    if(stats)
+    {
+      stats->used.store(false, std::memory_order_release);
+    }
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::wait_detached() /*throw(Gears::Exception)*/
+  {
+    if(executor_)
+    {
+      executor_->wait_detached(this);
+    }
+  }
+
+  TaskRunner::TaskRunnerJob::WorkerStats*
+  TaskRunner::TaskRunnerJob::acquire_worker_stats_() noexcept
   {
-    for(;;)
+    for(unsigned long i = 0; i < NUMBER_OF_THREADS_; ++i)
     {
+      bool used = false;
+      if(worker_stats_[i].used.compare_exchange_strong(
+           used, true, std::memory_order_acquire))
       {
-        SyncPolicy::ReadGuard guard(mutex());
-        if(tasks_.empty())
-        {
-          return;
-        }
+        return &worker_stats_[i];
       }
-      Gears::Time wait(0, 300000);
-      select(0, 0, 0, 0, &wait);
     }
+
+    return 0;
   }
 
   void
-  TaskRunner::TaskRunnerJob::work() noexcept
+  TaskRunner::TaskRunnerJob::overflow_(unsigned long count) noexcept
   {
-    static const char* FUN = "TaskRunner::TaskRunnerJob::work()";
+    overflows_.fetch_add(count, std::memory_order_relaxed);
+  }
 
-    try
+  TaskRunner::Stats
+  TaskRunner::TaskRunnerJob::stats() noexcept
+  {
+    Stats stats;
+
+    for(unsigned long i = 0; i < NUMBER_OF_THREADS_; ++i)
     {
-      for(;;)
+      worker_stats_[i].queue_wait.collect(stats.queue_wait);
+      worker_stats_[i].execution.collect(stats.execution);
+    }
+
+    stats.overflows = overflows_.load(std::memory_order_relaxed);
+    stats.enqueue_waits = enqueue_waits_.load(std::memory_order_relaxed);
+    stats.expired = expired_.load(std::memory_order_relaxed);
+    stats.cancelled = cancelled_.load(std::memory_order_relaxed);
+    stats.max_queue_depth = max_queue_depth_.load(std::memory_order_relaxed);
+
+    return stats;
+  }
+
+  bool
+  TaskRunner::TaskRunnerJob::wait_task_() /*throw(Gears::Exception)*/
+  {
+    if(ELASTIC_)
+    {
+      while(!new_task_.timed_acquire(&IDLE_TIMEOUT_, true))
       {
-        Task_var task;
-        {
-          new_task_.acquire();
-          SyncPolicy::WriteGuard guard(mutex());
-          if(is_terminating())
-          {
-            break;
-          }
-          assert(!tasks_.empty());
-          task = tasks_.front();
-          tasks_.pop_front();
-        }
+        Mutex::WriteGuard guard(mutex());
 
-        // Tell any blocked thread that the queue is ready for a "new item"
-        if(LIMITED_)
+        if(!is_terminating() &&
+           thread_count_.load(std::memory_order_relaxed) > MIN_THREADS_)
         {
-          not_full_.release();
+          // retire: terminate() will not count this thread
+          thread_count_.fetch_sub(1, std::memory_order_relaxed);
+          return false;
         }
+      }
+    }
+    else
+    {
+      new_task_.acquire();
+    }
 
-        try
-        {
-          task->execute();
-        }
-        catch (const Gears::Exception& ex)
-        {
-          callback()->report_error(
-            ActiveObjectCallback::ERROR,
-            SubString(ex.what()));
-        }
+    return !is_terminating();
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::grow_() noexcept
+  {
+    static const char* FUN = "TaskRunner::TaskRunnerJob::grow_()";
+
+    // threads are added one at a time, concurrent requests are dropped
+    if(growing_.exchange(true, std::memory_order_acquire))
+    {
+      return;
+    }
+
+    try
+    {
+      Mutex::WriteGuard guard(mutex());
+
+      if(thread_runner_ &&
+         thread_runner_->running() &&
+         !is_terminating() &&
+         thread_count_.load(std::memory_order_relaxed) < NUMBER_OF_THREADS_ &&
+         thread_runner_->restart_one())
+      {
+        thread_count_.fetch_add(1, std::memory_order_relaxed);
       }
     }
-    catch (const Gears::Exception& e)
+    catch (const Gears::Exception& ex)
     {
       ErrorStream ostr;
-      ostr << FUN << ": Gears::Exception: " << e.what();
+      ostr << FUN << ": can't add thread: " << ex.what();
       callback()->report_error(
-        ActiveObjectCallback::CRITICAL_ERROR,
+        ActiveObjectCallback::WARNING,
         ostr.str());
     }
+
+    growing_.store(false, std::memory_order_release);
+  }
+
+  void
+  TaskRunner::TaskRunnerJob::started(unsigned threads) noexcept
+  {
+    thread_count_.store(
+      threads ? threads : NUMBER_OF_THREADS_,
+      std::memory_order_relaxed);
+
+    if(executor_)
+    {
+      executor_->attach(this);
+    }
   }
 
   void
   TaskRunner::TaskRunnerJob::terminate() noexcept
   {
-    for(unsigned long i = NUMBER_OF_THREADS_; i; i--)
+    if(executor_)
     {
-      new_task_.release();
+      executor_->detach(this);
+      return;
     }
+
+    // wake every running thread, retired ones are not counted
+    new_task_.release(static_cast<int>(
+      thread_count_.load(std::memory_order_relaxed)));
   }
 
+  //
+  // TaskRunner::Stats class
+  //
+
+  TaskRunner::Stats::Stats() noexcept
+    : overflows(0),
+      enqueue_waits(0),
+      expired(0),
+      cancelled(0),
+      max_queue_depth(0)
+  {}
+
   //
   // TaskRunner class
   //
 
+  const unsigned long TaskRunner::DEFAULT_LOCK_FREE_CAPACITY;
+
+  TaskRunner::TaskRunner(
+    ActiveObjectCallback_var callback,
+    unsigned int threads_number,
+    const ThreadRunner::Options& thread_options,
+    unsigned long max_pending_tasks,
+    QueueType queue_type)
+    /*throw(InvalidArgument, Exception, Gears::Exception)*/
+    : ActiveObjectCommonImpl(
+        TaskRunnerJob_var(new TaskRunnerJob(
+          std::move(callback),
+          ElasticOptions(threads_number, threads_number),
+          max_pending_tasks,
+          create_queue_(queue_type, threads_number, max_pending_tasks))),
+        threads_number, thread_options),
+      job_(static_cast<TaskRunnerJob&>(*SINGLE_JOB_))
+  {}
+
   TaskRunner::TaskRunner(
     ActiveObjectCallback_var callback,
     unsigned int threads_number,
     size_t stack_size,
     unsigned long max_pending_tasks)
     /*throw(InvalidArgument, Exception, Gears::Exception)*/
+    : TaskRunner(
+        std::move(callback),
+        threads_number,
+        ThreadRunner::Options(stack_size),
+        max_pending_tasks)
+  {}
+
+  TaskRunner::TaskRunner(
+    ActiveObjectCallback_var callback,
+    unsigned int threads_number,
+    const LaneArray& lanes,
+    LanePolicy lane_policy,
+    const ThreadRunner::Options& thread_options)
+    /*throw(InvalidArgument, Exception, Gears::Exception)*/
+    : ActiveObjectCommonImpl(
+        TaskRunnerJob_var(new TaskRunnerJob(
+          std::move(callback),
+          ElasticOptions(threads_number, threads_number),
+          0,
+          create_lane_queue_(lanes, lane_policy))),
+        threads_number, thread_options),
+      job_(static_cast<TaskRunnerJob&>(*SINGLE_JOB_))
+  {}
+
+  TaskRunner::TaskRunner(
+    ActiveObjectCallback_var callback,
+    const ElasticOptions& elastic_options,
+    const ThreadRunner::Options& thread_options,
+    unsigned long max_pending_tasks,
+    QueueType queue_type)
+    /*throw(InvalidArgument, Exception, Gears::Exception)*/
     : ActiveObjectCommonImpl(
         TaskRunnerJob_var(new TaskRunnerJob(
           std::move(callback),
-          threads_number,
-          max_pending_tasks)),
-        threads_number, stack_size),
+          elastic_options,
+          max_pending_tasks,
+          create_queue_(
+            queue_type,
+            elastic_options.max_threads,
+            max_pending_tasks))),
+        elastic_options.max_threads,
+        thread_options,
+        elastic_options.min_threads),
+      job_(static_cast<TaskRunnerJob&>(*SINGLE_JOB_))
+  {
+    job_.thread_runner(thread_runner_);
+  }
+
+  TaskRunner::TaskRunner(
+    ActiveObjectCallback_var callback,
+    SharedExecutor_var executor,
+    unsigned long weight,
+    unsigned long max_pending_tasks,
+    QueueType queue_type)
+    /*throw(InvalidArgument, Exception, Gears::Exception)*/
+    : ActiveObjectCommonImpl(
+        TaskRunnerJob_var(new TaskRunnerJob(
+          std::move(callback),
+          executor_options_(executor, weight, queue_type),
+          max_pending_tasks,
+          create_queue_(queue_type, 0, max_pending_tasks),
+          executor,
+          weight)),
+        ExternalThreads()),
       job_(static_cast<TaskRunnerJob&>(*SINGLE_JOB_))
   {}
 
   TaskRunner::~TaskRunner() noexcept
   {}
+
+  void
+  TaskRunner::wait_object() /*throw(Exception, Gears::Exception)*/
+  {
+    job_.wait_detached();
+    ActiveObjectCommonImpl::wait_object();
+  }
+
+  void
+  TaskRunner::enqueue_goals(const GoalArray& goals)
+    /*throw(Overflow, NotActive, Gears::Exception)*/
+  {
+    std::vector<QueuedTask> tasks;
+    tasks.reserve(goals.size());
+    std::exception_ptr error;
+
+    for(auto it = goals.begin(); it != goals.end(); ++it)
+    {
+      Task_var task = std::dynamic_pointer_cast<Task>(*it);
+
+      if(task)
+      {
+        tasks.emplace_back(make_task_(std::move(task)));
+      }
+      else
+      {
+        try
+        {
+          (*it)->deliver();
+        }
+        catch (const Gears::Exception&)
+        {
+          if(!error)
+          {
+            error = std::current_exception();
+          }
+        }
+      }
+    }
+
+    try
+    {
+      job_.enqueue_tasks(tasks.data(), tasks.size(), 0);
+    }
+    catch (const Overflow&)
+    {
+      // tasks that are not moved into the queue keep their functors
+      for(auto it = tasks.begin(); it != tasks.end(); ++it)
+      {
+        if(it->task)
+        {
+          try
+          {
+            job_.enqueue_task(std::move(it->task), 0, 0);
+          }
+          catch (const Overflow&)
+          {
+            if(!error)
+            {
+              error = std::current_exception();
+            }
+            break;
+          }
+        }
+      }
+    }
+
+    if(error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  TaskRunner::TaskQueue_var
+  TaskRunner::create_queue_(
+    QueueType queue_type,
+    unsigned long number_of_threads,
+    unsigned long max_pending_tasks)
+    /*throw(Gears::Exception)*/
+  {
+    if(queue_type == QT_LOCK_FREE)
+    {
+      return TaskQueue_var(new LockFreeTaskQueue(
+        max_pending_tasks ? max_pending_tasks : DEFAULT_LOCK_FREE_CAPACITY));
+    }
+    else if(queue_type == QT_WORK_STEALING)
+    {
+      return TaskQueue_var(new WorkStealingTaskQueue(number_of_threads));
+    }
+
+    return TaskQueue_var(new LockedTaskQueue());
+  }
+
+  TaskRunner::ElasticOptions
+  TaskRunner::executor_options_(
+    const SharedExecutor_var& executor,
+    unsigned long weight,
+    QueueType queue_type)
+    /*throw(InvalidArgument)*/
+  {
+    static const char* FUN = "TaskRunner::executor_options_()";
+
+    if(!executor || !weight || queue_type == QT_WORK_STEALING)
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": executor is NULL or zero weight or "
+        "work stealing queue";
+      throw InvalidArgument(ostr.str());
+    }
+
+    const unsigned int threads = executor->thread_count();
+    return ElasticOptions(threads, threads);
+  }
+
+  TaskRunner::TaskQueue_var
+  TaskRunner::create_lane_queue_(
+    const LaneArray& lanes,
+    LanePolicy lane_policy)
+    /*throw(InvalidArgument, Gears::Exception)*/
+  {
+    static const char* FUN = "TaskRunner::create_lane_queue_()";
+
+    if(lanes.empty())
+    {
+      ErrorStream ostr;
+      ostr << FUN << ": lanes array is empty";
+      throw InvalidArgument(ostr.str());
+    }
+
+    return TaskQueue_var(new LaneTaskQueue(lanes, lane_policy));
+  }
 }
@@ -1,3 +1,11 @@
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
 #include <gears/Errno.hpp>
 #include <gears/OutputMemoryStream.hpp>
 
@@ -5,6 +13,52 @@
 
 namespace Gears
 {
+  namespace
+  {
+    // memory policy mode of set_mempolicy(2), numaif.h isn't required
+    const int MPOL_BIND_MODE = 2;
+    const int NUMA_NODES_MAX = 1024;
+    const unsigned THREAD_NAME_SIZE = 15;
+
+    /**
+     * Parses kernel CPU list format: "0-3,8,10-11"
+     */
+    bool
+    parse_cpu_list(const char* str, ThreadRunner::CpuList& cpus) noexcept
+    {
+      while (*str && *str != '\n')
+      {
+        char* end;
+        const unsigned long first = std::strtoul(str, &end, 10);
+        if (end == str)
+        {
+          return false;
+        }
+        unsigned long last = first;
+        str = end;
+        if (*str == '-')
+        {
+          last = std::strtoul(++str, &end, 10);
+          if (end == str || last < first)
+          {
+            return false;
+          }
+          str = end;
+        }
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+        {
+          cpus.push_back(static_cast<unsigned>(cpu));
+        }
+        if (*str == ',')
+        {
+          ++str;
+        }
+      }
+
+      return true;
+    }
+  }
+
   //
   // ThreadCallback class
   //
@@ -17,6 +71,11 @@ namespace Gears
   ThreadCallback::on_stop() noexcept
   {}
 
+  void
+  ThreadCallback::on_placement_error(const Gears::SubString& /*description*/)
+    noexcept
+  {}
+
   //
   // ThreadRunner::Options class
   //
@@ -29,7 +88,9 @@ namespace Gears
     : stack_size(
         stack_size < (size_t)PTHREAD_STACK_MIN ? DEFAULT_STACK_SIZE :
         stack_size),
-      thread_callback(thread_callback)
+      thread_callback(thread_callback),
+      pin_round_robin(false),
+      numa_node(-1)
   {}
 
   //
@@ -77,6 +138,7 @@ namespace Gears
     /*throw (Gears::Exception, PosixException)*/
     : attr_(options.stack_size),
       thread_callback_(options.thread_callback),
+      numa_node_(options.numa_node),
       start_semaphore_(0),
       number_running_(0),
       number_of_jobs_(number_of_jobs)
@@ -87,6 +149,8 @@ namespace Gears
     {
       jobs_.emplace_back(new JobInfo(this, job));
     }
+
+    init_placement_(options);
   }
 
   ThreadRunner::~ThreadRunner() noexcept
@@ -100,19 +164,200 @@ namespace Gears
   }
 
   void
-  ThreadRunner::thread_func_(ThreadJob& job) noexcept
+  ThreadRunner::init_placement_(const Options& options)
+    /*throw (InvalidArgument, Gears::Exception)*/
+  {
+    static const char* FUN = "ThreadRunner::init_placement_()";
+
+    CpuList common_cpus;
+
+    if (options.numa_node >= NUMA_NODES_MAX)
+    {
+      Gears::ErrorStream ostr;
+      ostr << FUN << ": invalid NUMA node " << options.numa_node;
+      throw InvalidArgument(ostr.str());
+    }
+
+    if (options.numa_node >= 0)
+    {
+      char path[64];
+      std::snprintf(path, sizeof(path),
+        "/sys/devices/system/node/node%d/cpulist", options.numa_node);
+
+      char buf[1024] = "";
+      FILE* file = std::fopen(path, "r");
+      const bool read = file && std::fgets(buf, sizeof(buf), file);
+      if (file)
+      {
+        std::fclose(file);
+      }
+
+      if (!read || !parse_cpu_list(buf, common_cpus) || common_cpus.empty())
+      {
+        Gears::ErrorStream ostr;
+        ostr << FUN << ": can't get CPUs of NUMA node " << options.numa_node;
+        throw InvalidArgument(ostr.str());
+      }
+    }
+    else if (options.pin_round_robin && options.cpu_affinity.empty())
+    {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      if (::sched_getaffinity(0, sizeof(cpu_set), &cpu_set) < 0)
+      {
+        Gears::throw_errno_exception<PosixException>(
+          FUN, "can't get process affinity");
+      }
+
+      for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      {
+        if (CPU_ISSET(cpu, &cpu_set))
+        {
+          common_cpus.push_back(cpu);
+        }
+      }
+    }
+
+    const unsigned long SETS = options.cpu_affinity.size();
+
+    for (unsigned i = 0; i < number_of_jobs_; i++)
+    {
+      JobInfo& info = *jobs_[i];
+
+      const CpuList* set = SETS ? &options.cpu_affinity[i % SETS] : 0;
+
+      if (set && !set->empty())
+      {
+        for (auto it = set->begin(); it != set->end(); ++it)
+        {
+          if (*it >= CPU_SETSIZE)
+          {
+            Gears::ErrorStream ostr;
+            ostr << FUN << ": invalid CPU index " << *it;
+            throw InvalidArgument(ostr.str());
+          }
+
+          // mask is narrowed to the CPUs of NUMA node
+          if (options.numa_node < 0 ||
+              std::find(common_cpus.begin(), common_cpus.end(), *it) !=
+                common_cpus.end())
+          {
+            info.cpus.push_back(*it);
+          }
+        }
+
+        if (info.cpus.empty())
+        {
+          Gears::ErrorStream ostr;
+          ostr << FUN << ": no CPUs of NUMA node " << options.numa_node <<
+            " in the mask of thread " << i;
+          throw InvalidArgument(ostr.str());
+        }
+      }
+      else
+      {
+        info.cpus = common_cpus;
+      }
+
+      if (options.pin_round_robin && !info.cpus.empty())
+      {
+        // threads sharing a mask take its CPUs one by one
+        const unsigned long pos = (SETS ? i / SETS : i) % info.cpus.size();
+        info.cpus = CpuList(1, info.cpus[pos]);
+      }
+
+      if (!options.thread_name.empty())
+      {
+        std::string suffix("-");
+        suffix += std::to_string(i);
+        info.name = options.thread_name.substr(
+          0, THREAD_NAME_SIZE - std::min<size_t>(
+            suffix.size(), THREAD_NAME_SIZE));
+        info.name += suffix;
+        info.name.resize(std::min<size_t>(info.name.size(), THREAD_NAME_SIZE));
+      }
+    }
+  }
+
+  void
+  ThreadRunner::apply_placement_(const JobInfo& info) noexcept
+  {
+    static const char* FUN = "ThreadRunner::apply_placement_()";
+
+    Gears::ErrorStream ostr;
+
+    if (!info.name.empty())
+    {
+      const int RES = ::pthread_setname_np(::pthread_self(), info.name.c_str());
+      if (RES)
+      {
+        ostr << FUN << ": can't set thread name '" << info.name <<
+          "', error " << RES << "\n";
+      }
+    }
+
+    if (numa_node_ >= 0)
+    {
+      unsigned long node_mask[
+        NUMA_NODES_MAX / (sizeof(unsigned long) * 8)] = {};
+      node_mask[numa_node_ / (sizeof(unsigned long) * 8)] |=
+        1ul << (numa_node_ % (sizeof(unsigned long) * 8));
+
+      if (::syscall(
+            SYS_set_mempolicy,
+            MPOL_BIND_MODE,
+            node_mask,
+            static_cast<unsigned long>(NUMA_NODES_MAX)) < 0)
+      {
+        ostr << FUN << ": can't bind memory to NUMA node " << numa_node_ <<
+          ", errno " << errno << "\n";
+      }
+    }
+
+    if (!info.cpus.empty())
+    {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      for (auto it = info.cpus.begin(); it != info.cpus.end(); ++it)
+      {
+        CPU_SET(*it, &cpu_set);
+      }
+
+      const int RES = ::pthread_setaffinity_np(
+        ::pthread_self(), sizeof(cpu_set), &cpu_set);
+      if (RES)
+      {
+        ostr << FUN << ": can't set CPU affinity, error " << RES << "\n";
+      }
+    }
+
+    const Gears::SubString& str = ostr.str();
+    if (str.size())
+    {
+      // placement is an optimization: the job runs anyway
+      if (thread_callback_)
+      {
+        thread_callback_->on_placement_error(str);
+      }
+    }
+  }
+
+  void
+  ThreadRunner::thread_func_(JobInfo& info) noexcept
   {
     start_semaphore_.acquire();
     start_semaphore_.release();
 
     if (number_running_ > 0)
     {
+      apply_placement_(info);
+
       if (thread_callback_)
       {
         thread_callback_->on_start();
       }
 
-      job.work();
+      info.job->work();
 
       if (thread_callback_)
       {
@@ -125,29 +370,79 @@ namespace Gears
   ThreadRunner::thread_func_(void* arg) noexcept
   {
     JobInfo* info = static_cast<JobInfo*>(arg);
-    info->runner->thread_func_(*info->job);
+    info->runner->thread_func_(*info);
+    info->finished.store(true, std::memory_order_release);
     return 0;
   }
 
   void
-  ThreadRunner::start_one_thread_() /*throw (PosixException)*/
+  ThreadRunner::create_thread_(JobInfo& info, const char* fun)
+    /*throw (PosixException)*/
   {
-    static const char* FUN = "ThreadRunner::start_one_thread_()";
+    info.finished.store(false, std::memory_order_relaxed);
 
     const int RES = ::pthread_create(
-      &jobs_[number_running_]->thread_id,
+      &info.thread_id,
       attr_,
       thread_func_,
-      jobs_[number_running_].get());
+      &info);
 
     if (RES)
     {
-      Gears::throw_errno_exception<PosixException>(RES, FUN, "thread start");
+      Gears::throw_errno_exception<PosixException>(RES, fun, "thread start");
     }
+  }
 
+  void
+  ThreadRunner::start_one_thread_() /*throw (PosixException)*/
+  {
+    static const char* FUN = "ThreadRunner::start_one_thread_()";
+
+    create_thread_(*jobs_[number_running_], FUN);
     number_running_++;
   }
 
+  bool
+  ThreadRunner::restart_one() /*throw (PosixException)*/
+  {
+    static const char* FUN = "ThreadRunner::restart_one()";
+
+    for (int i = 0; i < number_running_; i++)
+    {
+      JobInfo& info = *jobs_[i];
+
+      if (info.no_thread || info.finished.load(std::memory_order_acquire))
+      {
+        if (!info.no_thread)
+        {
+          const int RES = ::pthread_join(info.thread_id, 0);
+
+          if (RES)
+          {
+            Gears::throw_errno_exception<PosixException>(
+              RES, FUN, "join failure");
+          }
+
+          info.no_thread = true;
+        }
+
+        // the job keeps its slot: thread name and placement are per slot
+        create_thread_(info, FUN);
+        info.no_thread = false;
+
+        return true;
+      }
+    }
+
+    if (static_cast<unsigned>(number_running_) < number_of_jobs_)
+    {
+      start_one_thread_();
+      return true;
+    }
+
+    return false;
+  }
+
   void
   ThreadRunner::wait_for_completion() /*throw (PosixException)*/
   {
@@ -158,6 +453,12 @@ namespace Gears
       Gears::ErrorStream ostr;
       for (int i = 0; i < abs(number_running_); i++)
       {
+        if (jobs_[i]->no_thread)
+        {
+          jobs_[i]->no_thread = false;
+          continue;
+        }
+
         const int RES = ::pthread_join(jobs_[i]->thread_id, 0);
 
         if (RES)
@@ -220,7 +521,11 @@ namespace Gears
       throw;
     }
 
-    start_semaphore_.release();
+    // runner without threads is never waited for
+    if (number_running_)
+    {
+      start_semaphore_.release();
+    }
   }
 
   void